@@ -0,0 +1,422 @@
+#include "builtins.h"
+#include "parser.h"
+#include "perf_counters.h"
+#include <AK/JsonArray.h>
+#include <AK/JsonObject.h>
+#include <AK/StringBuilder.h>
+#include <AK/Time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Every allocation made through operator new, which is how the interpreter allocates its nodes, values and containers.
+static size_t s_allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++s_allocations;
+    if (auto ptr = malloc(size))
+        return ptr;
+    abort();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+struct Options {
+    size_t scale { 1 };
+    size_t source_size { 1 * MiB };
+    u64 min_time_ns { 200'000'000 };
+    size_t max_iterations { 1000 };
+    StringView filter;
+    char const* output_file { nullptr };
+    bool perf_counters { false };
+};
+
+enum class Phase {
+    Lex,
+    Parse,
+    Run,
+};
+
+struct Benchmark {
+    StringView name;
+    StringView kind;
+    Phase phase;
+    Optional<String> (*source)(Options const&);
+    // Whether the script runs with inlining, as without `--no-inline`.
+    bool inlining { true };
+};
+
+struct Measurement {
+    size_t iterations { 0 };
+    u64 total_ns { 0 };
+    u64 min_ns { 0 };
+    size_t allocations { 0 };
+    size_t heap_allocations { 0 };
+    Optional<u64> counters[PerfCounters::counter_count];
+};
+
+static Optional<String> read_file(StringView path)
+{
+    auto file = fopen(String(path).characters(), "r");
+    if (!file) {
+        warnln("Failed to open {}: {}", path, strerror(errno));
+        return {};
+    }
+    StringBuilder builder;
+    char buffer[4096];
+    while (auto nread = fread(buffer, 1, sizeof(buffer), file))
+        builder.append(StringView { buffer, nread });
+    fclose(file);
+    return builder.to_string();
+}
+
+// The part of an example before `marker`, so its own demo calls can be replaced by a scaled one.
+static Optional<String> example_until(StringView name, StringView marker)
+{
+    auto contents = read_file(String::formatted("{}/{}", AAA_EXAMPLES_DIR, name));
+    if (!contents.has_value())
+        return {};
+    auto index = contents->find(marker);
+    if (!index.has_value()) {
+        warnln("{} no longer contains '{}'", name, marker);
+        return {};
+    }
+    return contents->substring(0, *index);
+}
+
+static String repeated_statement(StringView setup, StringView statement, size_t count)
+{
+    StringBuilder builder;
+    builder.append(setup);
+    builder.append('\n');
+    for (size_t i = 0; i < count; ++i) {
+        builder.append(statement);
+        builder.append('\n');
+    }
+    return builder.to_string();
+}
+
+// A syntactically varied program of at least `bytes` bytes, for benchmarking the front end on large inputs.
+static String generate_source(size_t bytes)
+{
+    StringBuilder builder;
+    for (size_t i = 0; builder.length() < bytes; ++i) {
+        builder.appendff("// value number {}\n", i);
+        builder.appendff("let v{} = add({} 1);\n", i, i);
+        builder.appendff("// function number {}\n", i);
+        builder.appendff("let f{} = {{ |x|: res let res = add(x v{} \"s{}\"); }};\n", i, i, i);
+        builder.appendff("let r{} = record {{ a b }};\n", i);
+        builder.appendff("f{}(<value number>).length;\n", i);
+        builder.appendff("r{}(1 \"two\").a;\n", i);
+    }
+    return builder.to_string();
+}
+
+static Optional<String> fib_source(Options const& options)
+{
+    auto definitions = example_until("fib.aaa"sv, "// // one option"sv);
+    if (!definitions.has_value())
+        return {};
+    return String::formatted("{}\ncollapse(<fib>({}));\n", *definitions, 2000 * options.scale);
+}
+
+static Benchmark const s_benchmarks[] = {
+    { "lex"sv, "micro"sv, Phase::Lex, [](Options const& options) -> Optional<String> { return generate_source(options.source_size); } },
+    { "parse"sv, "micro"sv, Phase::Parse, [](Options const& options) -> Optional<String> { return generate_source(options.source_size); } },
+    { "variable lookup"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("let v = 1;"sv, "v;"sv, 10000 * options.scale);
+     } },
+    { "function call"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("let f = { |x|: res let res = x; };"sv, "f(1);"sv, 10000 * options.scale);
+     } },
+    { "closure creation"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("let v = 1;"sv, "{ |x|: res let res = add(x v); };"sv, 10000 * options.scale);
+     } },
+    { "loop iteration"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return String::formatted(
+             "let acc = record {{ i }};\n"
+             "let step = {{ |a|: res let res = acc(add(a.i 1)); }};\n"
+             "let stop = {{ |a|: res let res = eq(a.i {}); }};\n"
+             "loop(acc(0) step stop);\n",
+             1000 * options.scale);
+     } },
+    { "record construction"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("let P = record { x y };"sv, "P(1 2);"sv, 10000 * options.scale);
+     } },
+    { "member access"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("let P = record { x y }; let p = P(1 2);"sv, "p.y;"sv, 10000 * options.scale);
+     } },
+    { "mention resolution"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("// the answer value\nlet answer = 42;"sv, "<answer>;"sv, 10000 * options.scale);
+     } },
+    { "string concatenation"sv, "micro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         return repeated_statement("let s = \"\";"sv, "let s = add(s \"x\");"sv, 2000 * options.scale);
+     } },
+    { "fib"sv, "macro"sv, Phase::Run, fib_source },
+    { "fib without inlining"sv, "macro"sv, Phase::Run, fib_source, false },
+    { "brainfork"sv, "macro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         auto definitions = example_until("brainfork.aaa"sv, "let example ="sv);
+         if (!definitions.has_value())
+             return {};
+         // A short tape keeps setup from dominating; each repetition moves 64 into the next cell and clears it again.
+         StringBuilder program;
+         for (size_t i = 0; i < options.scale; ++i)
+             program.append("++++++++[>++++++++<-]>[-]<"sv);
+         return String::formatted("{}\ninterpret(\"{}\");\n", definitions->replace("generate_zeros(30000)", "generate_zeros(256)"), program.to_string());
+     } },
+    { "types"sv, "macro"sv, Phase::Run, [](Options const& options) -> Optional<String> {
+         auto contents = read_file(String::formatted("{}/types.aaa", AAA_EXAMPLES_DIR));
+         if (!contents.has_value())
+             return {};
+         return String::formatted("{}\nLinkedList(int {});\n", *contents, 100 * options.scale);
+     } },
+};
+
+static Time start_timing(PerfCounters* counters)
+{
+    if (counters)
+        counters->start();
+    return Time::now_monotonic();
+}
+
+static u64 stop_timing(PerfCounters* counters, Time const& start)
+{
+    auto elapsed = static_cast<u64>((Time::now_monotonic() - start).to_nanoseconds());
+    if (counters)
+        counters->stop();
+    return elapsed;
+}
+
+// Times the phase the benchmark is about; when `counters` is given, hardware events are counted over the same interval.
+static Result<u64, String> run_once(Benchmark const& benchmark, String const& source, ContextSnapshot& base, PerfCounters* counters, size_t& heap_allocations)
+{
+    auto lexer = Lexer { source.view() };
+    auto parser = Parser { lexer };
+
+    if (benchmark.phase == Phase::Lex) {
+        auto start = start_timing(counters);
+        for (;;) {
+            auto token = lexer.next();
+            if (token.is_error())
+                return String::formatted("Lex error: {} at {}:{}", token.error().error, token.error().where.line, token.error().where.column);
+            if (token.value().type == Token::Type::Eof)
+                break;
+        }
+        return stop_timing(counters, start);
+    }
+
+    auto start = start_timing(benchmark.phase == Phase::Parse ? counters : nullptr);
+    auto nodes = parser.parse_toplevel();
+    auto parse_time = stop_timing(benchmark.phase == Phase::Parse ? counters : nullptr, start);
+    if (nodes.is_error())
+        return String::formatted("Parse error: {} at {}:{}", nodes.error().error, nodes.error().where.line, nodes.error().where.column);
+    if (benchmark.phase == Phase::Parse)
+        return parse_time;
+
+    auto context = base.fork();
+    context.inlining_enabled = benchmark.inlining;
+    Heap::Activation activation { *context.heap };
+    start = start_timing(counters);
+    for (auto& node : nodes.value())
+        node->run(context);
+    auto run_time = stop_timing(counters, start);
+    if (context.error.has_value())
+        return String::formatted("Runtime error: {}", *context.error);
+    heap_allocations += context.heap->total_usage().allocations;
+    return run_time;
+}
+
+static Result<Measurement, String> measure(Benchmark const& benchmark, String const& source, ContextSnapshot& base, PerfCounters* counters, Options const& options)
+{
+    Measurement measurement;
+    if (counters)
+        counters->reset_totals();
+    // Allocations are attributed to the whole iteration, including untimed parsing for runtime benchmarks.
+    auto allocations_before = s_allocations;
+    while (measurement.iterations < options.max_iterations && (measurement.iterations == 0 || measurement.total_ns < options.min_time_ns)) {
+        auto elapsed = run_once(benchmark, source, base, counters, measurement.heap_allocations);
+        if (elapsed.is_error())
+            return elapsed.release_error();
+        auto ns = elapsed.release_value();
+        measurement.min_ns = measurement.iterations == 0 ? ns : min(measurement.min_ns, ns);
+        measurement.total_ns += ns;
+        ++measurement.iterations;
+    }
+    measurement.allocations = s_allocations - allocations_before;
+    if (counters) {
+        for (size_t i = 0; i < PerfCounters::counter_count; ++i)
+            measurement.counters[i] = counters->total(static_cast<PerfCounters::Counter>(i));
+    }
+    return measurement;
+}
+
+static int print_help(char const* program_name, bool as_failure = false)
+{
+    outln("usage: {} [options]", program_name);
+    outln("  Runs the interpreter benchmarks and prints the results as JSON.");
+    outln("  options:");
+    outln("    --scale <n>               multiplies the size of every workload (default 1)");
+    outln("    --source-size <bytes>     size of the generated source for the lex and parse benchmarks (default {})", 1 * MiB);
+    outln("    --min-time-ms <ms>        run each benchmark at least this long (default 200)");
+    outln("    --max-iterations <n>      but at most this many times (default 1000)");
+    outln("    --filter <text>           only run benchmarks whose name contains <text>");
+    outln("    --output <file>           write the results to <file> instead of stdout");
+    outln("    --perf-counters           also count cycles, instructions, branch and cache misses and page faults");
+    outln("    --generate <bytes> <file> write a generated source of the given size to <file> and exit");
+    return as_failure ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        auto arg = StringView { argv[i] };
+        auto has_value = i + 1 < argc;
+        auto parse_size = [&](auto& target) {
+            auto value = StringView { argv[++i] }.to_uint<size_t>();
+            if (!value.has_value() || *value == 0)
+                return false;
+            target = *value;
+            return true;
+        };
+        if (arg == "--scale"sv && has_value) {
+            if (!parse_size(options.scale))
+                return print_help(argv[0], true);
+        } else if (arg == "--source-size"sv && has_value) {
+            if (!parse_size(options.source_size))
+                return print_help(argv[0], true);
+        } else if (arg == "--min-time-ms"sv && has_value) {
+            size_t milliseconds = 0;
+            if (!parse_size(milliseconds))
+                return print_help(argv[0], true);
+            options.min_time_ns = milliseconds * 1'000'000;
+        } else if (arg == "--max-iterations"sv && has_value) {
+            if (!parse_size(options.max_iterations))
+                return print_help(argv[0], true);
+        } else if (arg == "--filter"sv && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--output"sv && has_value) {
+            options.output_file = argv[++i];
+        } else if (arg == "--generate"sv && i + 2 < argc) {
+            size_t bytes = 0;
+            if (!parse_size(bytes))
+                return print_help(argv[0], true);
+            auto path = argv[++i];
+            auto file = fopen(path, "w");
+            if (!file) {
+                warnln("Failed to open {}: {}", path, strerror(errno));
+                return 1;
+            }
+            auto source = generate_source(bytes);
+            fwrite(source.characters(), 1, source.length(), file);
+            fclose(file);
+            return 0;
+        } else if (arg == "--perf-counters"sv) {
+            options.perf_counters = true;
+        } else if (arg == "--help"sv) {
+            return print_help(argv[0]);
+        } else {
+            return print_help(argv[0], true);
+        }
+    }
+
+    Context base_context;
+    {
+        Heap::Activation activation { *base_context.heap };
+        initialize_base(base_context);
+    }
+    auto base = ContextSnapshot::create(move(base_context), {});
+
+    OwnPtr<PerfCounters> counters;
+    if (options.perf_counters) {
+        counters = make<PerfCounters>();
+        if (!counters->is_available()) {
+            warnln("perf_event_open is not available (see /proc/sys/kernel/perf_event_paranoid), continuing without counters");
+            counters = nullptr;
+        }
+    }
+
+    // Whatever the workloads print would end up in the results otherwise.
+    fflush(stdout);
+    auto saved_stdout = dup(STDOUT_FILENO);
+    auto null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    JsonArray results;
+    auto failed = false;
+    for (auto& benchmark : s_benchmarks) {
+        if (!options.filter.is_empty() && !benchmark.name.contains(options.filter))
+            continue;
+
+        auto source = benchmark.source(options);
+        if (!source.has_value()) {
+            failed = true;
+            continue;
+        }
+
+        auto measurement = measure(benchmark, *source, *base, counters.ptr(), options);
+        if (measurement.is_error()) {
+            warnln("{}: {}", benchmark.name, measurement.error());
+            failed = true;
+            continue;
+        }
+
+        auto& value = measurement.value();
+        warnln("{}: {} iterations, {}ns mean, {}ns min", benchmark.name, value.iterations, value.total_ns / value.iterations, value.min_ns);
+
+        JsonObject result;
+        result.set("name", String { benchmark.name });
+        result.set("kind", String { benchmark.kind });
+        result.set("inlining", benchmark.inlining);
+        result.set("input_bytes", source->length());
+        result.set("iterations", value.iterations);
+        result.set("total_ns", value.total_ns);
+        result.set("mean_ns", value.total_ns / value.iterations);
+        result.set("min_ns", value.min_ns);
+        result.set("allocations_per_iteration", value.allocations / value.iterations);
+        result.set("heap_allocations_per_iteration", value.heap_allocations / value.iterations);
+        if (counters) {
+            JsonObject per_iteration;
+            for (size_t i = 0; i < PerfCounters::counter_count; ++i) {
+                if (value.counters[i].has_value())
+                    per_iteration.set(String { PerfCounters::name(static_cast<PerfCounters::Counter>(i)) }, *value.counters[i] / value.iterations);
+            }
+            result.set("counters_per_iteration", move(per_iteration));
+        }
+        results.append(move(result));
+    }
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    JsonObject report;
+    report.set("scale", options.scale);
+    report.set("source_size", options.source_size);
+    report.set("benchmarks", move(results));
+
+    if (options.output_file) {
+        auto file = fopen(options.output_file, "w");
+        if (!file) {
+            warnln("Failed to open {}: {}", options.output_file, strerror(errno));
+            return 1;
+        }
+        auto json = report.to_string();
+        fwrite(json.characters(), 1, json.length(), file);
+        fputc('\n', file);
+        fclose(file);
+    } else {
+        outln("{}", report.to_string());
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+#include "perf_counters.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+StringView PerfCounters::name(Counter counter)
+{
+    switch (counter) {
+    case Counter::Cycles:
+        return "cycles"sv;
+    case Counter::Instructions:
+        return "instructions"sv;
+    case Counter::BranchMisses:
+        return "branch_misses"sv;
+    case Counter::L1DataMisses:
+        return "l1d_misses"sv;
+    case Counter::LastLevelCacheMisses:
+        return "llc_misses"sv;
+    case Counter::PageFaults:
+        return "page_faults"sv;
+    case Counter::__Count:
+        break;
+    }
+    VERIFY_NOT_REACHED();
+}
+
+static int open_counter(PerfCounters::Counter counter)
+{
+    perf_event_attr attributes {};
+    attributes.size = sizeof(attributes);
+    attributes.disabled = 1;
+    // Unprivileged users may usually only count their own user-space events.
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (counter) {
+    case PerfCounters::Counter::Cycles:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PerfCounters::Counter::Instructions:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PerfCounters::Counter::BranchMisses:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case PerfCounters::Counter::L1DataMisses:
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PerfCounters::Counter::LastLevelCacheMisses:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case PerfCounters::Counter::PageFaults:
+        attributes.type = PERF_TYPE_SOFTWARE;
+        attributes.config = PERF_COUNT_SW_PAGE_FAULTS;
+        break;
+    case PerfCounters::Counter::__Count:
+        VERIFY_NOT_REACHED();
+    }
+
+    return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+
+PerfCounters::PerfCounters()
+{
+    for (size_t i = 0; i < counter_count; ++i)
+        m_fds[i] = open_counter(static_cast<Counter>(i));
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (auto fd : m_fds) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+bool PerfCounters::is_available() const
+{
+    for (auto fd : m_fds) {
+        if (fd >= 0)
+            return true;
+    }
+    return false;
+}
+
+void PerfCounters::start()
+{
+    for (auto fd : m_fds) {
+        if (fd < 0)
+            continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void PerfCounters::stop()
+{
+    for (size_t i = 0; i < counter_count; ++i) {
+        if (m_fds[i] < 0)
+            continue;
+        ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        struct {
+            u64 value;
+            u64 time_enabled;
+            u64 time_running;
+        } reading {};
+        if (read(m_fds[i], &reading, sizeof(reading)) != sizeof(reading) || reading.time_running == 0)
+            continue;
+        // The kernel multiplexes counters when there are more than the PMU has, extrapolate to the whole interval.
+        if (reading.time_running < reading.time_enabled)
+            reading.value = static_cast<u64>(static_cast<double>(reading.value) * reading.time_enabled / reading.time_running);
+        m_totals[i] += reading.value;
+    }
+}
+
+void PerfCounters::reset_totals()
+{
+    for (auto& total : m_totals)
+        total = 0;
+}
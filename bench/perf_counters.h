@@ -0,0 +1,50 @@
+#pragma once
+
+#include <AK/Noncopyable.h>
+#include <AK/Optional.h>
+#include <AK/StringView.h>
+#include <AK/Types.h>
+
+// Hardware and software event counters for the calling thread, through perf_event_open(2).
+// Counters the kernel or the machine doesn't provide are simply left out.
+class PerfCounters {
+    AK_MAKE_NONCOPYABLE(PerfCounters);
+    AK_MAKE_NONMOVABLE(PerfCounters);
+
+public:
+    enum class Counter : u8 {
+        Cycles,
+        Instructions,
+        BranchMisses,
+        L1DataMisses,
+        LastLevelCacheMisses,
+        PageFaults,
+        __Count,
+    };
+
+    static constexpr size_t counter_count = to_underlying(Counter::__Count);
+
+    static StringView name(Counter);
+
+    PerfCounters();
+    ~PerfCounters();
+
+    bool is_available() const;
+
+    void start();
+    void stop();
+
+    // The sum over every start()/stop() pair since the last reset, scaled up if the counter was multiplexed.
+    Optional<u64> total(Counter counter) const
+    {
+        auto index = to_underlying(counter);
+        if (m_fds[index] < 0)
+            return {};
+        return m_totals[index];
+    }
+    void reset_totals();
+
+private:
+    int m_fds[counter_count];
+    u64 m_totals[counter_count] {};
+};
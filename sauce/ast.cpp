@@ -1,16 +1,48 @@
 #include "ast.h"
+#include "builtins.h"
+#include "jit.h"
+#include "memo.h"
+#include <AK/AnyOf.h>
 #include <AK/Function.h>
+#include <AK/StringBuilder.h>
 #include <AK/TypeCasts.h>
+#include <pthread.h>
+
+static FlatPtr find_native_stack_limit()
+{
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+        return 1;
+    void* lowest = nullptr;
+    size_t size = 0;
+    pthread_attr_getstack(&attributes, &lowest, &size);
+    pthread_attr_destroy(&attributes);
+    return reinterpret_cast<FlatPtr>(lowest) + min(size / 4, Context::native_stack_reserve);
+}
 
 Value ASTNode::run(Context& context)
 {
+    if (!context.native_stack_limit) [[unlikely]]
+        context.native_stack_limit = find_native_stack_limit();
+    if (reinterpret_cast<FlatPtr>(__builtin_frame_address(0)) < context.native_stack_limit && !context.error.has_value()) [[unlikely]]
+        context.error = String::formatted("Stack overflow: out of native stack {} calls deep", context.call_stack.size());
+    if (!context.heap->collect_if_needed() && !context.error.has_value())
+        context.error = String::formatted("Memory limit of {} bytes exceeded", context.heap->memory_limit());
+    if (context.error.has_value()) [[unlikely]]
+        return { Empty {} };
+    if (context.profiler)
+        context.profiler->poll();
+
     auto value = execute(context);
     if (is<Statement>(this) && !is<Comment>(*static_cast<Statement*>(this)->node())) {
         auto comments = move(context.unassigned_comments);
-        for (auto& entry : comments) {
-            auto all = context.comment_scope.last().get(entry).value_or({});
-            all.append(value);
-            context.comment_scope.last().set(entry, move(all));
+        if (!comments.is_empty()) {
+            auto& frame = context.comment_scope.last();
+            for (auto& entry : comments) {
+                auto all = frame.get(entry).value_or({});
+                all.append(value);
+                frame.set(entry, move(all));
+            }
         }
     }
 
@@ -37,49 +69,74 @@ void DirectMention::dump(int indent)
 }
 
 Value DirectMention::execute(Context& context)
+{
+    if (!context.tracer) [[likely]]
+        return resolve(context);
+
+    auto start = Tracer::now();
+    auto result = resolve(context);
+    StringBuilder name;
+    name.append('<');
+    name.join(' ', m_keywords);
+    name.append('>');
+    auto size = result.value.get<NonnullRefPtr<CommentResolutionSet>>()->size();
+    context.tracer->complete("mention"sv, name.string_view(), start, String::formatted("\"keywords\":\"{}\",\"results\":{}", Tracer::escape(name.string_view()), size));
+    return result;
+}
+
+Value DirectMention::resolve(Context& context)
 {
     auto crs = make_ref_counted<CommentResolutionSet>();
     if (m_keywords.is_empty())
         return Value { move(crs) };
 
+    if (m_static_comments.has_value()) {
+        ++context.statistics.mentions_resolved;
+        auto& frame = context.comment_scope.last();
+        for (auto* comment : *m_static_comments) {
+            if (auto values = frame.find(comment))
+                crs->values.extend(*values);
+        }
+        crs->account(crs->values.size() * sizeof(Value));
+        return Value { move(crs) };
+    }
+
+    // Builtins that were rebound in the global scope are no longer reachable by mentions.
+    u64 shadowed_builtins = 0;
+    ++context.statistics.mentions_resolved;
     for (size_t i = context.scope.size(); i > 0; --i) {
         auto& scope = context.scope[i - 1];
-        for (auto& entry : scope) {
-            if (auto nfn = entry.value.value.get_pointer<NativeFunctionType>()) {
-                for (auto& query : m_keywords) {
-                    auto found = false;
-                    for (auto& comment : nfn->comments) {
-                        if (comment.contains(query)) {
-                            found = true;
-                            goto out;
-                        }
-                    }
-                out:;
-                    if (!found)
-                        goto not_this_entry;
-                }
-                crs->values.append(entry.value);
-                continue;
+        context.statistics.mention_candidates_examined += scope.size();
+        scope.for_each([&](auto& name, auto& value) {
+            if (i == 1) {
+                if (auto builtin = find_builtin(name))
+                    shadowed_builtins |= 1ull << (builtin - builtins().data());
             }
-        not_this_entry:;
-        }
+            if (auto nfn = value.value.template get_pointer<NativeFunctionType>()) {
+                if (matches_all(nfn->comment_words, m_keywords))
+                    crs->values.append(value);
+            }
+        });
+    }
+    for (auto& builtin : builtins()) {
+        if (shadowed_builtins & (1ull << (&builtin - builtins().data())))
+            continue;
+        ++context.statistics.mention_candidates_examined;
+        if (matches_all(builtin.comment.span(), m_keywords))
+            crs->values.append(builtin.value());
     }
     for (size_t i = context.comment_scope.size(); i > 0; --i) {
         auto& scope = context.comment_scope[i - 1];
-        for (auto& entry : scope) {
-            auto fail = false;
+        context.statistics.mention_candidates_examined += scope.size();
+        scope.for_each([&](Comment* comment, auto& values) {
             for (auto& query : m_keywords) {
-                if (!entry.key->text().contains(query)) {
-                    fail = true;
-                    break;
-                }
-            }
-            if (!fail) {
-                for (auto& value : entry.value)
-                    crs->values.append(value);
+                if (!comment->text().contains(query))
+                    return;
             }
-        }
+            crs->values.extend(values);
+        });
     }
+    crs->account(crs->values.size() * sizeof(Value));
     return Value { move(crs) };
 }
 
@@ -99,6 +156,46 @@ Value IndirectMention::execute(Context& context)
     return make_ref_counted<DirectMention>(move(words))->run(context);
 }
 
+FunctionNode::FunctionNode(Vector<NonnullRefPtr<Variable>> parameters, RefPtr<Variable> return_, Vector<NonnullRefPtr<ASTNode>> expressions)
+    : m_parameters(move(parameters))
+    , m_return(move(return_))
+    , m_expressions(move(expressions))
+{
+    if (!m_return || m_expressions.is_empty())
+        return;
+    auto* last = m_expressions.last().ptr();
+    if (is<Statement>(*last))
+        last = static_cast<Statement&>(*last).node().ptr();
+    if (!last || !is<Assignment>(*last))
+        return;
+    // A typed assignment still has to coerce what the call returns, so it isn't the last thing done.
+    auto& assignment = static_cast<Assignment&>(*last);
+    if (assignment.variable()->name() == m_return->name() && !assignment.variable()->type() && is<Call>(*assignment.value()))
+        static_cast<Call&>(*assignment.value()).mark_as_tail_call_of(*this);
+}
+
+FunctionNode::~FunctionNode() = default;
+
+Optional<Value> FunctionNode::run_compiled(Context& context, Vector<Value> const& arguments)
+{
+    if (!m_compiled) {
+        if (++m_call_count < JitCode::hot_call_count)
+            return {};
+        m_compiled = JitCode::compile(*this);
+        if (!m_compiled) {
+            m_compilable = false;
+            return {};
+        }
+    }
+
+    auto result = m_compiled->call(arguments);
+    if (result.has_value())
+        ++context.statistics.compiled_calls;
+    else
+        ++context.statistics.deoptimizations;
+    return result;
+}
+
 void FunctionNode::dump(int indent)
 {
     ASTNode::dump(indent);
@@ -113,6 +210,11 @@ Value FunctionNode::execute(Context& context)
     auto cscope = context.comment_scope;
     for (size_t i = 0; i < context.last_call_scope_start; ++i)
         cscope.take_first();
+
+    ++context.statistics.closures_created;
+    context.statistics.captured_frames += scope.size() + cscope.size();
+    for (auto& frame : scope)
+        context.statistics.captured_bindings += frame.size();
     return {
         FunctionValue {
             NonnullRefPtr<FunctionNode>(*this),
@@ -122,6 +224,63 @@ Value FunctionNode::execute(Context& context)
     };
 }
 
+static Value defer(Context& context, NonnullRefPtr<CommentResolutionSet> const& source, ASTNode& node, Vector<Value> arguments)
+{
+    ++context.statistics.sets_deferred;
+    auto set = make_ref_counted<CommentResolutionSet>();
+    set->deferred = adopt_own(*new CommentResolutionSet::DeferredMap { source, node, move(arguments) });
+    return Value { move(set) };
+}
+
+CommentResolutionSet::DeferredMap::~DeferredMap() = default;
+
+Value CommentResolutionSet::at(Context& context, size_t index) const
+{
+    while (deferred && values.size() <= index) {
+        auto position = values.size();
+        // Copied, as a nested pull may finish the set and drop the map.
+        auto source = deferred->source;
+        auto node = deferred->node;
+        auto arguments = deferred->arguments;
+        auto source_value = source->at(context, position);
+        auto result = is<Call>(*node)
+            ? static_cast<Call&>(*node).call(context, source_value, arguments)
+            : static_cast<MemberAccess&>(*node).access(context, source_value);
+        ++context.statistics.deferred_values_computed;
+        if (values.size() != position)
+            continue;
+        values.append(move(result));
+        const_cast<CommentResolutionSet&>(*this).account(sizeof(Value));
+        if (deferred && values.size() == deferred->source->size())
+            deferred = nullptr;
+    }
+    return values[index];
+}
+
+Vector<Value>& CommentResolutionSet::materialize(Context& context) const
+{
+    if (deferred)
+        at(context, size() - 1);
+    return values;
+}
+
+static bool contains_assignment(ASTNode& node)
+{
+    if (is<Assignment>(node))
+        return true;
+    auto found = false;
+    node.for_each_child([&](auto& child) { found = found || contains_assignment(*child); });
+    return found;
+}
+
+Call::Call(NonnullRefPtr<ASTNode> callee, Vector<NonnullRefPtr<ASTNode>> arguments)
+    : m_callee(move(callee))
+    , m_arguments(move(arguments))
+{
+    // Looking a name up has no side effects, but the arguments might rebind it.
+    m_callee_first = is<Variable>(*m_callee) && !any_of(m_arguments, [](auto& argument) { return contains_assignment(*argument); });
+}
+
 void Call::dump(int indent)
 {
     ASTNode::dump(indent);
@@ -132,129 +291,231 @@ void Call::dump(int indent)
         arg->dump(indent + 2);
 }
 
+// Calls a native through `invoke`, as a frame of its own in profiles.
+template<typename Invoke>
+static Value call_native(Context& context, NativeFunction fn, Invoke invoke)
+{
+    if (!context.profiler)
+        return invoke();
+    auto builtin = find_builtin(fn);
+    context.profiler->enter(reinterpret_cast<void const*>(fn), builtin ? builtin->name : "<native>"sv);
+    auto result = invoke();
+    context.profiler->leave();
+    return result;
+}
+
 Value Call::execute(Context& context)
 {
+    Optional<Value> callee;
+    if (m_callee_first) {
+        callee = m_callee->run(context);
+        if (auto native = callee->value.get_pointer<NativeFunctionType>(); native && native->lazy_fn) {
+            ++context.statistics.native_calls;
+            return call_native(context, native->fn, [&] { return native->lazy_fn(context, { m_arguments.data(), m_arguments.size() }); });
+        }
+    }
+
     Vector<Value> arguments;
     for (auto& arg : m_arguments)
         arguments.append(arg->run(context));
-    auto fn = m_callee->run(context);
-    Function<Value(Value&)> execute = [&](auto& callee) -> Value {
-        if (auto ptr = callee.value.template get_pointer<NativeFunctionType>())
-            return ptr->fn(context, arguments.data(), arguments.size());
-        if (auto ptr = callee.value.template get_pointer<NonnullRefPtr<CommentResolutionSet>>()) {
-            auto set_ptr = ptr->ptr();
-            auto crs = make_ref_counted<CommentResolutionSet>();
-            for (auto& entry : set_ptr->values)
-                crs->values.append(execute(entry));
-            return Value { move(crs) };
+    auto fn = callee.has_value() ? callee.release_value() : m_callee->run(context);
+    auto native = fn.value.get_pointer<NativeFunctionType>();
+    if (m_feedback.is_specialized() && !context.profiler) {
+        if (native && native->fn == m_feedback.kind() && has_integer_fast_path(native->fn, arguments)) {
+            if (auto result = call_integer_fast_path(native->fn, arguments); result.has_value()) {
+                ++context.statistics.native_calls;
+                ++context.statistics.specialized_executions;
+                return result.release_value();
+            }
+        } else {
+            m_feedback.give_up();
+            ++context.statistics.despecializations;
+        }
+    } else if (m_feedback.is_learning()) {
+        m_feedback.record(native && has_integer_fast_path(native->fn, arguments) ? native->fn : Optional<NativeFunction> {});
+    }
+
+    if (m_tail_call_of && !context.call_stack.is_empty()) {
+        auto& frame = context.call_stack.last();
+        if (auto function = fn.value.get_pointer<FunctionValue>(); function && frame.function == m_tail_call_of && frame.takes_tail_calls) {
+            context.tail_call = TailCall { move(*function), move(arguments) };
+            return { Empty {} };
         }
-        if (auto ptr = callee.value.template get_pointer<FunctionValue>()) {
-            auto last_scope = move(context.scope);
-            auto last_cscope = move(context.comment_scope);
+    }
 
-            auto last_stack_start = context.last_call_scope_start;
-            context.last_call_scope_start = context.scope.size();
+    return call(context, fn, arguments);
+}
 
-            context.scope.extend(ptr->scope);
-            context.comment_scope.extend(ptr->comment_scope);
+Value Call::call(Context& context, Value& callee, Vector<Value>& arguments)
+{
+    if (auto ptr = callee.value.template get_pointer<NativeFunctionType>()) {
+        ++context.statistics.native_calls;
+        return call_native(context, ptr->fn, [&] { return ptr->fn(context, arguments.data(), arguments.size()); });
+    }
+    if (auto ptr = callee.value.template get_pointer<NonnullRefPtr<CommentResolutionSet>>()) {
+        auto& set = **ptr;
+        // Only calls that provably can't print or change anything may be put off; pure callees never call their arguments.
+        if (set.size() >= CommentResolutionSet::defer_threshold && is_pure_callee(callee))
+            return defer(context, *ptr, *this, arguments);
+        auto crs = make_ref_counted<CommentResolutionSet>();
+        for (auto& entry : set.materialize(context))
+            crs->values.append(call(context, entry, arguments));
+        crs->account(crs->values.size() * sizeof(Value));
+        return Value { move(crs) };
+    }
+    if (auto ptr = callee.value.template get_pointer<FunctionValue>()) {
+        ++context.statistics.user_calls;
+        if (context.jit_enabled && ptr->node->is_compilable()) {
+            if (auto result = ptr->node->run_compiled(context, arguments); result.has_value())
+                return result.release_value();
+        }
+        if (context.call_stack.size() >= context.max_call_depth) {
+            context.error = String::formatted("Stack overflow: more than {} nested calls", context.max_call_depth);
+            return { Empty {} };
+        }
+        // The caller's state waits on the call stack, rather than on the native one, until the callee returns.
+        context.call_stack.append({
+            ptr->node.ptr(),
+            move(context.scope),
+            move(context.comment_scope),
+            move(context.unassigned_comments),
+            context.last_call_scope_start,
+            true,
+        });
+        context.last_call_scope_start = 0;
+
+        FunctionValue const* function = ptr;
+        Vector<Value>* function_arguments = &arguments;
+        Optional<TailCall> tail_call;
+        Value result { Empty {} };
+        for (;;) {
+            context.scope.extend(function->scope);
+            context.comment_scope.extend(function->comment_scope);
 
             context.scope.template empend();
             context.comment_scope.template empend();
             auto& scope = context.scope.last();
 
-            if (ptr->node->return_())
-                scope.set(ptr->node->return_()->name(), { Empty {} });
+            if (function->node->return_())
+                scope.set(function->node->return_()->name(), Value { Empty {} });
 
             size_t i = 0;
-            for (auto& param : ptr->node->parameters()) {
-                if (arguments.size() > i)
-                    scope.set(param->name(), arguments[i]);
+            for (auto& param : function->node->parameters()) {
+                if (function_arguments->size() > i)
+                    scope.set(param->name(), function_arguments->at(i));
                 else
-                    scope.set(param->name(), { Empty {} });
+                    scope.set(param->name(), Value { Empty {} });
                 ++i;
             }
 
-            auto old_comments = move(context.unassigned_comments);
-            for (auto& node : ptr->node->body())
+            if (context.profiler)
+                context.profiler->enter(function->node.ptr(), function->node->name());
+            auto start = context.tracer ? Tracer::now() : 0;
+            for (auto& node : function->node->body())
                 node->run(context);
+            if (context.tracer)
+                context.tracer->complete("call"sv, function->node->name(), start);
+            if (context.profiler)
+                context.profiler->leave();
+
+            if (!context.tail_call.has_value()) {
+                // Note: The body may have copied the frame out from under `scope`, so look it up again.
+                if (function->node->return_())
+                    result = context.scope.last().get(function->node->return_()->name()).value();
+                break;
+            }
 
-            Value result { Empty {} };
-            if (ptr->node->return_())
-                result = scope.get(ptr->node->return_()->name()).value();
+            // The body ended in a tail call, which takes over this frame instead of nesting a new one in it.
+            tail_call = context.tail_call.release_value();
+            function = &tail_call->function;
+            function_arguments = &tail_call->arguments;
+            context.scope.clear();
+            context.comment_scope.clear();
+            context.unassigned_comments.clear();
+            context.call_stack.last().function = function->node.ptr();
+            ++context.statistics.user_calls;
+            ++context.statistics.tail_calls;
+            if (context.jit_enabled && function->node->is_compilable()) {
+                if (auto compiled_result = function->node->run_compiled(context, *function_arguments); compiled_result.has_value()) {
+                    result = compiled_result.release_value();
+                    break;
+                }
+            }
+        }
 
-            context.scope = move(last_scope);
-            context.comment_scope = move(last_cscope);
-            context.unassigned_comments = move(old_comments);
-            context.last_call_scope_start = last_stack_start;
+        auto frame = context.call_stack.take_last();
+        context.scope = move(frame.caller_scope);
+        context.comment_scope = move(frame.caller_comment_scope);
+        context.unassigned_comments = move(frame.caller_unassigned_comments);
+        context.last_call_scope_start = frame.caller_scope_start;
 
-            return result;
-        }
-        if (auto ptr = callee.value.template get_pointer<NonnullRefPtr<Type>>()) {
-            Type* type_ptr = ptr->ptr();
-            if (auto type = type_ptr->decl.template get_pointer<NativeType>()) {
-                if (arguments.is_empty()) {
-                    return { Empty {} };
-                }
-                auto& first = flatten(arguments.first());
-                switch (*type) {
-                case NativeType::Any:
-                    return first;
-                case NativeType::Int:
-                    if (first.value.template has<NumberType>())
-                        return first;
-                    if (first.value.template has<String>())
-                        return { NumberType((u64)first.value.template get<String>()[0]) };
-                case NativeType::String:
-                    if (first.value.template has<String>())
-                        return first;
-                    if (first.value.template has<NumberType>())
-                        return { String::repeated(first.value.template get<NumberType>().to<char>(), 1) };
-                }
+        return result;
+    }
+    if (auto ptr = callee.value.template get_pointer<NonnullRefPtr<Type>>()) {
+        Type* type_ptr = ptr->ptr();
+        if (auto type = type_ptr->decl.template get_pointer<NativeType>()) {
+            if (arguments.is_empty()) {
                 return { Empty {} };
             }
+            auto& first = flatten(arguments.first());
+            switch (*type) {
+            case NativeType::Any:
+                return first;
+            case NativeType::Int:
+                if (first.value.template has<NumberType>())
+                    return first;
+                if (first.value.template has<String>())
+                    return { NumberType((u64)first.value.template get<String>()[0]) };
+                if (auto mapped = first.value.template get_pointer<MappedString>(); mapped && !mapped->is_empty())
+                    return { NumberType((u64)mapped->view()[0]) };
+            case NativeType::String:
+                if (first.value.template has<String>() || first.value.template has<MappedString>())
+                    return first;
+                if (first.value.template has<NumberType>())
+                    return { context.track(String::repeated(first.value.template get<NumberType>().to<char>(), 1)) };
+            }
+            return { Empty {} };
+        }
 
-            auto& fields = type_ptr->decl.template get<Vector<TypeName>>();
-            Vector<Value> values;
-            bool did_initialize = false;
-            if (arguments.size() > 0 && arguments.size() < fields.size()) {
-                if (auto rv = arguments[0].value.template get_pointer<RecordValue>()) {
-                    if (auto rfields = rv->type->decl.template get_pointer<Vector<TypeName>>()) {
-                        if (rfields->size() >= fields.size()) {
-                            size_t index = 0;
-                            for (auto& entry : rv->members) {
-                                values.append(
-                                    make_ref_counted<Call>(
-                                        static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(Value { fields[index].type })),
-                                        Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(entry)) })
-                                        ->run(context));
-                                ++index;
-                            }
-                            did_initialize = true;
+        auto& fields = type_ptr->decl.template get<Vector<TypeName>>();
+        Vector<Value> values;
+        bool did_initialize = false;
+        if (arguments.size() > 0 && arguments.size() < fields.size()) {
+            if (auto rv = arguments[0].value.template get_pointer<RecordValue>()) {
+                if (auto rfields = rv->type->decl.template get_pointer<Vector<TypeName>>()) {
+                    if (rfields->size() >= fields.size()) {
+                        size_t index = 0;
+                        for (auto& entry : rv->members->values) {
+                            values.append(
+                                make_ref_counted<Call>(
+                                    static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(Value { fields[index].type })),
+                                    Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(entry)) })
+                                    ->run(context));
+                            ++index;
                         }
+                        did_initialize = true;
                     }
                 }
             }
+        }
 
-            if (!did_initialize) {
-                size_t index = 0;
-                for (auto& type_name : fields) {
-                    if (arguments.size() <= index)
-                        values.append({ Empty {} });
-                    else
-                        values.append(
-                            make_ref_counted<Call>(
-                                static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(Value { type_name.type })),
-                                Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(arguments[index])) })
-                                ->run(context));
-                    ++index;
-                }
+        if (!did_initialize) {
+            size_t index = 0;
+            for (auto& type_name : fields) {
+                if (arguments.size() <= index)
+                    values.append({ Empty {} });
+                else
+                    values.append(
+                        make_ref_counted<Call>(
+                            static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(Value { type_name.type })),
+                            Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(arguments[index])) })
+                            ->run(context));
+                ++index;
             }
-            return { RecordValue { *type_ptr, move(values) } };
         }
-        return { Empty {} };
-    };
-
-    return execute(fn);
+        return { RecordValue::create(*type_ptr, move(values)) };
+    }
+    return { Empty {} };
 }
 
 void Variable::dump(int indent)
@@ -267,24 +528,72 @@ void Variable::dump(int indent)
     }
 }
 
+// Coerces `value` to the type `type_node` evaluates to, as calling that type would. Sites that keep seeing values that
+// are already represented as the same native type pass them through without building the call.
+static Value coerce(Context& context, ASTNode& type_node, Value value, TypeFeedback<NativeType>& feedback)
+{
+    auto type = type_node.run(context);
+    Optional<NativeType> native;
+    if (auto type_ptr = type.value.get_pointer<NonnullRefPtr<Type>>()) {
+        if (auto native_ptr = (*type_ptr)->decl.get_pointer<NativeType>())
+            native = *native_ptr;
+    }
+    auto is_represented_as = [&](NativeType native) {
+        switch (native) {
+        case NativeType::Int:
+            return value.value.has<NumberType>();
+        case NativeType::String:
+            return value.value.has<String>() || value.value.has<MappedString>();
+        case NativeType::Any:
+            return !value.value.has<NonnullRefPtr<CommentResolutionSet>>();
+        }
+        VERIFY_NOT_REACHED();
+    };
+
+    if (feedback.is_specialized()) {
+        if (native.has_value() && *native == feedback.kind() && is_represented_as(*native)) {
+            ++context.statistics.specialized_executions;
+            return value;
+        }
+        feedback.give_up();
+        ++context.statistics.despecializations;
+    } else if (feedback.is_learning()) {
+        feedback.record(native.has_value() && is_represented_as(*native) ? native : Optional<NativeType> {});
+    }
+
+    return make_ref_counted<Call>(
+        make_ref_counted<SyntheticNode>(move(type)),
+        Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(move(value))) })
+        ->run(context);
+}
+
 Value Variable::execute(Context& context)
 {
+    Optional<Value> value;
     for (size_t i = context.scope.size(); i > 0; --i) {
-        auto& scope = context.scope[i - 1];
-        if (!scope.contains(m_name))
+        auto found = context.scope[i - 1].find(m_name);
+        if (!found)
             continue;
 
-        auto value = scope.find(m_name)->value;
-        if (m_type) {
-            value = make_ref_counted<Call>(
-                *m_type,
-                Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(value)) })
-                        ->run(context);
-        }
+        context.statistics.did_look_up(context.scope.size() - i);
+        value = *found;
+        break;
+    }
 
-        return value;
+    if (!value.has_value()) {
+        auto builtin = find_builtin(m_name);
+        if (!builtin) {
+            ++context.statistics.unresolved_lookups;
+            return { Empty {} };
+        }
+        ++context.statistics.builtin_lookups;
+        value = builtin->value();
     }
-    return { Empty {} };
+
+    if (m_type)
+        return coerce(context, *m_type, value.release_value(), m_coercion_feedback);
+
+    return value.release_value();
 }
 
 void RecordDecl::dump(int indent)
@@ -331,83 +640,108 @@ void MemberAccess::dump(int indent)
 
 Value MemberAccess::execute(Context& context)
 {
-    auto value = m_base->run(context);
-    Function<Value(Value const&)> visit = [&](auto const& value) {
-        return value.value.visit(
-            [](Empty) -> Value { return { Empty {} }; },
-            [&](String const& string) -> Value {
-                if (m_property == "length"sv)
-                    return { string.length() };
-                return { Empty {} };
-            },
-            [&](NumberType const& value) -> Value {
-                if (m_property.is_one_of("negated"sv, "neg"sv))
-                    return { -value };
+    return access(context, m_base->run(context));
+}
 
-                return { Empty {} };
-            },
-            [](FunctionValue const&) -> Value { return { Empty {} }; },
-            [](NativeFunctionType const&) -> Value { return { Empty {} }; },
-            [this](NonnullRefPtr<Type> const& type) -> Value {
-                if (m_property == "is_native"sv)
-                    return { type->decl.template has<NativeType>() };
-
-                if (m_property == "members"sv) {
-                    auto type_ptr = type->decl.template get_pointer<Vector<TypeName>>();
-                    if (!type_ptr)
-                        return { Empty {} };
-
-                    Vector<TypeName> types;
-                    Vector<Value> values;
-
-                    types.append({ .name = "length",
-                        .type = make_ref_counted<Type>(NativeType::Int) });
-                    values.append({ type_ptr->size() });
-
-                    size_t index = 0;
-                    for (auto& entry : *type_ptr) {
-                        TypeName type {
-                            .name = String::formatted("_{}", index),
-                            .type = make_ref_counted<Type>(NativeType::Any)
-                        };
-
-                        types.append(move(type));
-                        values.append({ entry.name });
-                        ++index;
-                    }
-                    return { RecordValue {
-                        .type = make_ref_counted<Type>(move(types)),
-                        .members = move(values),
-                    } };
-                }
+Value MemberAccess::access(Context& context, Value const& value)
+{
+    return value.value.visit(
+        [](Empty) -> Value { return { Empty {} }; },
+        [&](String const& string) -> Value {
+            if (m_property == "length"sv)
+                return { string.length() };
+            return { Empty {} };
+        },
+        [&](MappedString const& string) -> Value {
+            if (m_property == "length"sv)
+                return { string.length };
+            return { Empty {} };
+        },
+        [&](NumberType const& value) -> Value {
+            if (m_property.is_one_of("negated"sv, "neg"sv))
+                return { -value };
+
+            return { Empty {} };
+        },
+        [](FunctionValue const&) -> Value { return { Empty {} }; },
+        [](NativeFunctionType const&) -> Value { return { Empty {} }; },
+        [this](NonnullRefPtr<Type> const& type) -> Value {
+            if (m_property == "is_native"sv)
+                return { type->decl.template has<NativeType>() };
+
+            if (m_property == "members"sv) {
+                auto type_ptr = type->decl.template get_pointer<Vector<TypeName>>();
+                if (!type_ptr)
+                    return { Empty {} };
+
+                Vector<TypeName> types;
+                Vector<Value> values;
+
+                types.append({ .name = "length",
+                    .type = make_ref_counted<Type>(NativeType::Int) });
+                values.append({ type_ptr->size() });
 
-                return { Empty {} };
-            },
-            [&](RecordValue const& rv) -> Value {
-                if (rv.type->decl.template has<NativeType>())
-                    return visit(rv.members.first());
-                Optional<size_t> pindex;
                 size_t index = 0;
-                for (auto& entry : rv.type->decl.template get<Vector<TypeName>>()) {
-                    if (entry.name == m_property) {
-                        pindex = index;
-                        break;
-                    }
+                for (auto& entry : *type_ptr) {
+                    TypeName type {
+                        .name = String::formatted("_{}", index),
+                        .type = make_ref_counted<Type>(NativeType::Any)
+                    };
+
+                    types.append(move(type));
+                    values.append({ entry.name });
                     ++index;
                 }
-                if (!pindex.has_value())
-                    return { Empty {} };
+                return { RecordValue::create(make_ref_counted<Type>(move(types)), move(values)) };
+            }
 
-                return rv.members.at(*pindex);
-            },
-            [&](NonnullRefPtr<CommentResolutionSet> const& crs) -> Value {
-                auto res_crs = make_ref_counted<CommentResolutionSet>();
-                for (auto& entry : crs->values)
-                    res_crs->values.append(visit(const_cast<Value&>(entry)));
-                return { move(res_crs) };
-            });
-    };
-    return visit(value);
+            return { Empty {} };
+        },
+        [&](RecordValue const& rv) -> Value {
+            if (m_feedback.is_specialized()) {
+                if (rv.type.ptr() == m_feedback.kind()) {
+                    ++context.statistics.specialized_executions;
+                    return rv.members->values.at(m_specialized_index);
+                }
+                m_feedback.give_up();
+                m_specialized_type = nullptr;
+                ++context.statistics.despecializations;
+            }
+            if (rv.type->decl.template has<NativeType>())
+                return access(context, rv.members->values.first());
+            Optional<size_t> pindex;
+            size_t index = 0;
+            for (auto& entry : rv.type->decl.template get<Vector<TypeName>>()) {
+                if (entry.name == m_property) {
+                    pindex = index;
+                    break;
+                }
+                ++index;
+            }
+            if (m_feedback.is_learning()) {
+                // Members are only ever appended to a record type, so a member's index stays valid for as long as
+                // the type lives.
+                m_feedback.record(pindex.has_value() ? rv.type.ptr() : Optional<Type const*> {});
+                if (m_feedback.is_specialized()) {
+                    m_specialized_type = rv.type;
+                    m_specialized_index = *pindex;
+                }
+            }
+            if (!pindex.has_value())
+                return { Empty {} };
+
+            return rv.members->values.at(*pindex);
+        },
+        [&](NonnullRefPtr<CommentResolutionSet> const& crs) -> Value {
+            if (crs->size() >= CommentResolutionSet::defer_threshold)
+                return defer(context, crs, *this, {});
+            auto res_crs = make_ref_counted<CommentResolutionSet>();
+            for (auto& entry : crs->materialize(context))
+                res_crs->values.append(access(context, entry));
+            res_crs->account(res_crs->values.size() * sizeof(Value));
+            return { move(res_crs) };
+        },
+        [](NonnullRefPtr<Sequence> const&) -> Value { return { Empty {} }; });
 }
 
 void Assignment::dump(int indent)
@@ -422,12 +756,8 @@ void Assignment::dump(int indent)
 Value Assignment::execute(Context& context)
 {
     auto value = m_value->run(context);
-    if (m_variable->type()) {
-        value = make_ref_counted<Call>(
-            *const_cast<RefPtr<ASTNode>&>(m_variable->type()),
-            Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(value)) })
-                    ->run(context);
-    }
+    if (m_variable->type())
+        value = coerce(context, *const_cast<RefPtr<ASTNode>&>(m_variable->type()), move(value), m_coercion_feedback);
     context.scope.last().set(m_variable->name(), value);
     return value;
 }
@@ -436,7 +766,7 @@ NonnullRefPtr<Type> type_from(Value const& value)
 {
     if (value.value.has<NumberType>())
         return make_ref_counted<Type>(NativeType::Int);
-    if (value.value.has<String>())
+    if (value.value.has<String>() || value.value.has<MappedString>())
         return make_ref_counted<Type>(NativeType::String);
     if (auto ptr = value.value.get_pointer<RecordValue>())
         return ptr->type;
@@ -464,8 +794,157 @@ Value List::execute(Context& context)
         values.append(move(value));
         ++index;
     }
-    return { RecordValue {
-        .type = make_ref_counted<Type>(move(types)),
-        .members = move(values),
-    } };
+    return { RecordValue::create(make_ref_counted<Type>(move(types)), move(values)) };
+}
+
+Optional<InlineCall> InlineCall::create(Context const& context, Value const& callee)
+{
+    if (!context.inlining_enabled)
+        return {};
+    auto returns_set = false;
+    auto function = callee.value.get_pointer<FunctionValue>();
+    if (auto set = callee.value.get_pointer<NonnullRefPtr<CommentResolutionSet>>(); set && (*set)->size() == 1 && !(*set)->deferred) {
+        function = (*set)->values.first().value.get_pointer<FunctionValue>();
+        returns_set = true;
+    }
+    if (!function)
+        return {};
+
+    auto& node = *function->node;
+    if (node.parameters().size() != 1 || !node.return_() || node.body().size() > max_statements)
+        return {};
+    for (auto& statement : node.body()) {
+        auto& expression = is<Statement>(*statement) ? *static_cast<Statement&>(*statement).node() : *statement;
+        if (is<Comment>(expression))
+            return {};
+        if (is<Assignment>(expression)) {
+            auto& name = static_cast<Assignment&>(expression).variable()->name();
+            if (name != node.parameters().first()->name() && name != node.return_()->name())
+                return {};
+        }
+    }
+
+    InlineCall inline_call { *function, returns_set };
+    inline_call.m_scope = function->scope;
+    inline_call.m_scope.empend();
+    inline_call.m_comment_scope = function->comment_scope;
+    inline_call.m_comment_scope.empend();
+    return inline_call;
+}
+
+Value InlineCall::call(Context& context, Value argument)
+{
+    ++context.statistics.user_calls;
+    auto& node = *m_function.node;
+    if (context.call_stack.size() >= context.max_call_depth) {
+        context.error = String::formatted("Stack overflow: more than {} nested calls", context.max_call_depth);
+        return { Empty {} };
+    }
+    // The caller's scope is swapped into this call's own, so the frame only has to count towards the depth.
+    context.call_stack.append({ &node, {}, {}, {}, 0 });
+
+    swap(context.scope, m_scope);
+    swap(context.comment_scope, m_comment_scope);
+    auto last_stack_start = exchange(context.last_call_scope_start, 0);
+    auto old_comments = move(context.unassigned_comments);
+
+    // A closure made by a previous call may hold on to the frame, in which case this writes to a layer over it.
+    auto& scope = context.scope.last();
+    scope.set(node.parameters().first()->name(), move(argument));
+    scope.set(node.return_()->name(), Value { Empty {} });
+
+    if (context.profiler)
+        context.profiler->enter(&node, node.name());
+    auto start = context.tracer ? Tracer::now() : 0;
+    for (auto& statement : node.body())
+        statement->run(context);
+    if (context.tracer)
+        context.tracer->complete("call"sv, node.name(), start);
+    if (context.profiler)
+        context.profiler->leave();
+
+    auto result = context.scope.last().get(node.return_()->name()).value();
+
+    context.call_stack.take_last();
+    swap(context.scope, m_scope);
+    swap(context.comment_scope, m_comment_scope);
+    context.last_call_scope_start = last_stack_start;
+    context.unassigned_comments = move(old_comments);
+
+    if (!m_returns_set)
+        return result;
+    auto crs = make_ref_counted<CommentResolutionSet>();
+    crs->values.append(move(result));
+    crs->account(sizeof(Value));
+    return Value { move(crs) };
+}
+
+static void for_each_child_in(RefPtr<ASTNode>& slot, Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    if (!slot)
+        return;
+    NonnullRefPtr<ASTNode> child = *slot;
+    callback(child);
+    slot = move(child);
+}
+
+void Statement::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    for_each_child_in(m_node, callback);
+}
+
+void IndirectMention::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    for_each_child_in(m_node, callback);
+}
+
+void FunctionNode::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    for (auto& expression : m_expressions)
+        callback(expression);
+}
+
+void Call::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    callback(m_callee);
+    for (auto& argument : m_arguments)
+        callback(argument);
+}
+
+void Variable::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    for_each_child_in(m_type, callback);
+}
+
+void RecordDecl::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    for (auto& decl : m_decls)
+        decl->for_each_child(callback);
+}
+
+void MemberAccess::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    callback(m_base);
+}
+
+void List::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    for (auto& entry : m_entries)
+        callback(entry);
+}
+
+void Assignment::for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const& callback)
+{
+    m_variable->for_each_child(callback);
+    callback(m_value);
+}
+
+Context ContextSnapshot::fork()
+{
+    Context context;
+    context.scope = m_context.scope;
+    context.comment_scope = m_context.comment_scope;
+    context.last_call_scope_start = m_context.last_call_scope_start;
+    context.base = *this;
+    return context;
 }
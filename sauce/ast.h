@@ -1,7 +1,10 @@
 #pragma once
 
+#include "feedback.h"
+#include "lexer.h"
 #include "types.h"
 #include <AK/Demangle.h>
+#include <AK/Function.h>
 
 class ASTNode : public RefCounted<ASTNode> {
 public:
@@ -13,9 +16,17 @@ public:
         warnln("{: >{}} {}", "", indent, demangle(typeid(*this).name()));
     }
 
+    Token::Position const& position() const { return m_position; }
+    void set_position(Token::Position position) { m_position = position; }
+
+    // Calls `callback` with every expression slot of this node, so that passes may replace children in place.
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) { }
+
 private:
     friend class Statement;
     virtual Value execute(Context&) = 0;
+
+    Token::Position m_position;
 };
 
 class SyntheticNode : public ASTNode {
@@ -43,6 +54,8 @@ public:
 
     auto& node() const { return m_node; }
 
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     virtual Value execute(Context& context) { return m_node->execute(context); }
     virtual void dump(int indent) override { m_node->dump(indent); }
@@ -57,6 +70,8 @@ public:
     {
     }
 
+    i64 value() const { return m_value; }
+
 private:
     virtual Value execute(Context&) { return { m_value }; }
     virtual void dump(int indent) override;
@@ -71,6 +86,8 @@ public:
     {
     }
 
+    auto& value() const { return m_value; }
+
 private:
     virtual Value execute(Context&) { return { m_value }; }
     virtual void dump(int indent) override;
@@ -78,6 +95,8 @@ private:
     String m_value;
 };
 
+class Comment;
+
 class DirectMention : public ASTNode {
 public:
     explicit DirectMention(Vector<String> keywords)
@@ -85,11 +104,19 @@ public:
     {
     }
 
+    auto& keywords() const { return m_keywords; }
+
+    // For mentions that can only ever match these comments, all bound in the block the mention is in by the time it runs.
+    void resolve_statically(Vector<Comment*> comments) { m_static_comments = move(comments); }
+
 private:
     virtual Value execute(Context&) override;
     virtual void dump(int indent) override;
 
+    Value resolve(Context&);
+
     Vector<String> m_keywords;
+    Optional<Vector<Comment*>> m_static_comments;
 };
 
 class IndirectMention : public ASTNode {
@@ -99,6 +126,8 @@ public:
     {
     }
 
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     virtual Value execute(Context&) override;
     virtual void dump(int indent) override;
@@ -107,20 +136,32 @@ private:
 };
 
 class Variable;
+class JitCode;
 
 class FunctionNode : public ASTNode {
 public:
-    explicit FunctionNode(Vector<NonnullRefPtr<Variable>> parameters, RefPtr<Variable> return_, Vector<NonnullRefPtr<ASTNode>> expressions)
-        : m_parameters(move(parameters))
-        , m_return(move(return_))
-        , m_expressions(move(expressions))
-    {
-    }
+    // A call assigned to the return variable by the last statement of `expressions` is marked as a tail call.
+    explicit FunctionNode(Vector<NonnullRefPtr<Variable>> parameters, RefPtr<Variable> return_, Vector<NonnullRefPtr<ASTNode>> expressions);
+
+    virtual ~FunctionNode() override;
 
     auto& parameters() const { return m_parameters; }
     auto& return_() const { return m_return; }
     auto& body() { return m_expressions; }
 
+    // What the function is known as in profiles: its describing comments, or the variable it's assigned to.
+    String const& name() const { return m_name; }
+    void set_name(String name) { m_name = move(name); }
+
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
+    // Set by the optimizer once it's known that the JIT may compile this function.
+    void set_compilable() { m_compilable = true; }
+    bool is_compilable() const { return m_compilable; }
+
+    // Runs the call through compiled code once the function is hot; returns nothing if it has to be interpreted.
+    Optional<Value> run_compiled(Context&, Vector<Value> const& arguments);
+
 private:
     virtual Value execute(Context&) override;
     virtual void dump(int indent) override;
@@ -128,15 +169,27 @@ private:
     Vector<NonnullRefPtr<Variable>> m_parameters;
     RefPtr<Variable> m_return;
     Vector<NonnullRefPtr<ASTNode>> m_expressions;
+    String m_name;
+
+    bool m_compilable { false };
+    u32 m_call_count { 0 };
+    OwnPtr<JitCode> m_compiled;
 };
 
 class Call : public ASTNode {
 public:
-    explicit Call(NonnullRefPtr<ASTNode> callee, Vector<NonnullRefPtr<ASTNode>> arguments)
-        : m_callee(move(callee))
-        , m_arguments(move(arguments))
-    {
-    }
+    explicit Call(NonnullRefPtr<ASTNode> callee, Vector<NonnullRefPtr<ASTNode>> arguments);
+
+    auto& callee() const { return m_callee; }
+    auto& arguments() const { return m_arguments; }
+
+    // Calls `callee` on evaluated arguments, as this node would.
+    Value call(Context&, Value& callee, Vector<Value>& arguments);
+
+    // Marks this call as the last thing `function` does, so that a user function it calls can take over its frame.
+    void mark_as_tail_call_of(FunctionNode const& function) { m_tail_call_of = &function; }
+
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
 
 private:
     Value execute(Context&) override;
@@ -144,6 +197,10 @@ private:
 
     NonnullRefPtr<ASTNode> m_callee;
     Vector<NonnullRefPtr<ASTNode>> m_arguments;
+    TypeFeedback<NativeFunction> m_feedback;
+    FunctionNode const* m_tail_call_of { nullptr };
+    // Whether the callee can be looked up before the arguments are evaluated, to find natives taking them lazily.
+    bool m_callee_first { false };
 };
 
 class Variable : public ASTNode {
@@ -157,12 +214,15 @@ public:
     auto& name() const { return m_name; }
     auto& type() const { return m_type; }
 
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     Value execute(Context&) override;
     virtual void dump(int indent) override;
 
     String m_name;
     RefPtr<ASTNode> m_type;
+    TypeFeedback<NativeType> m_coercion_feedback;
 };
 
 class RecordDecl : public ASTNode {
@@ -172,6 +232,8 @@ public:
     {
     }
 
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     Value execute(Context&) override;
     virtual void dump(int indent) override;
@@ -203,12 +265,24 @@ public:
     {
     }
 
+    auto& property() const { return m_property; }
+    auto& base() const { return m_base; }
+
+    // Accesses the property on an evaluated base, as this node would.
+    Value access(Context&, Value const& base);
+
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     Value execute(Context&) override;
     virtual void dump(int indent) override;
 
     String m_property;
     NonnullRefPtr<ASTNode> m_base;
+    TypeFeedback<Type const*> m_feedback;
+    // Held so that the specialized-for type can't be freed and its address reused by a different one.
+    RefPtr<Type> m_specialized_type;
+    size_t m_specialized_index { 0 };
 };
 
 class List : public ASTNode {
@@ -218,6 +292,8 @@ public:
     {
     }
 
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     Value execute(Context&) override;
 
@@ -232,10 +308,64 @@ public:
     {
     }
 
+    auto& variable() const { return m_variable; }
+    auto& value() const { return m_value; }
+
+    virtual void for_each_child(Function<void(NonnullRefPtr<ASTNode>&)> const&) override;
+
 private:
     virtual Value execute(Context&) override;
     virtual void dump(int indent) override;
 
     NonnullRefPtr<Variable> m_variable;
     NonnullRefPtr<ASTNode> m_value;
+    TypeFeedback<NativeType> m_coercion_feedback;
+};
+
+// Calls a small one-parameter closure the way Call would, but reuses the scope set up for it between calls.
+// Only closures whose bodies bind no comments and assign nothing but their parameter and return variable qualify, so
+// that the reuse can't be observed. Like a call, calling a resolution set of one such closure yields a resolution set.
+class InlineCall {
+public:
+    static constexpr size_t max_statements = 4;
+
+    // Nothing if `callee` doesn't qualify, or the context doesn't inline calls.
+    static Optional<InlineCall> create(Context const&, Value const& callee);
+
+    Value call(Context&, Value argument);
+
+private:
+    InlineCall(FunctionValue function, bool returns_set)
+        : m_function(move(function))
+        , m_returns_set(returns_set)
+    {
+    }
+
+    FunctionValue m_function;
+    bool m_returns_set { false };
+    Vector<Frame<Scope>> m_scope;
+    Vector<Frame<CommentScope>> m_comment_scope;
+};
+
+class ContextSnapshot : public RefCounted<ContextSnapshot> {
+public:
+    // Freezes `context`; `nodes` are the statements that were run to produce it, and must outlive every fork.
+    static NonnullRefPtr<ContextSnapshot> create(Context&& context, Vector<NonnullRefPtr<ASTNode>> nodes)
+    {
+        return adopt_ref(*new ContextSnapshot(move(context), move(nodes)));
+    }
+
+    Context fork();
+
+private:
+    ContextSnapshot(Context&& context, Vector<NonnullRefPtr<ASTNode>> nodes)
+        : m_context(move(context))
+        , m_nodes(move(nodes))
+    {
+        // Forks print through their own buffers, whatever this one still holds has to come first.
+        m_context.output->flush();
+    }
+
+    Context m_context;
+    Vector<NonnullRefPtr<ASTNode>> m_nodes;
 };
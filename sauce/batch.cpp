@@ -0,0 +1,165 @@
+#include "batch.h"
+#include <AK/Atomic.h>
+#include <AK/Time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct ScriptResult {
+    // An anonymous file holding what the script printed.
+    int output_fd { -1 };
+    int status { 0 };
+    u64 elapsed_ns { 0 };
+    bool done { false };
+};
+
+struct Batch {
+    Vector<String> const& paths;
+    Vector<ScriptResult> results;
+    Atomic<size_t> next_index { 0 };
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t result_ready = PTHREAD_COND_INITIALIZER;
+};
+
+struct Worker {
+    Batch* batch { nullptr };
+    NonnullOwnPtr<Interpreter> interpreter;
+    pthread_t thread {};
+};
+
+static ScriptResult run_script(Interpreter& interpreter, String const& path)
+{
+    ScriptResult result;
+    auto start = Time::now_monotonic();
+    result.output_fd = memfd_create("aaa-batch-output", MFD_CLOEXEC);
+    if (result.output_fd < 0) {
+        warnln("Failed to capture the output of {}: {}", path, strerror(errno));
+        result.status = 1;
+        return result;
+    }
+
+    if (auto file = MappedFile::map(path)) {
+        result.status = interpreter.run(file->bytes(), result.output_fd, result.output_fd);
+    } else {
+        OutputBuffer errors { result.output_fd, 0 };
+        errors.appendff("Failed to open {}: {}", path, strerror(errno));
+        errors.end_line();
+        result.status = 1;
+    }
+    result.elapsed_ns = (Time::now_monotonic() - start).to_nanoseconds();
+    return result;
+}
+
+static void* run_worker(void* argument)
+{
+    auto& worker = *static_cast<Worker*>(argument);
+    auto& batch = *worker.batch;
+    for (;;) {
+        auto index = batch.next_index.fetch_add(1);
+        if (index >= batch.paths.size())
+            return nullptr;
+
+        auto result = run_script(*worker.interpreter, batch.paths[index]);
+        result.done = true;
+        pthread_mutex_lock(&batch.mutex);
+        batch.results[index] = result;
+        pthread_cond_broadcast(&batch.result_ready);
+        pthread_mutex_unlock(&batch.mutex);
+    }
+}
+
+static void copy_output(int fd, OutputBuffer& report)
+{
+    if (fd < 0)
+        return;
+    lseek(fd, 0, SEEK_SET);
+    char buffer[64 * KiB];
+    for (;;) {
+        auto nread = read(fd, buffer, sizeof(buffer));
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+        report.append(StringView { buffer, static_cast<size_t>(nread) });
+    }
+    close(fd);
+}
+
+int run_batch(Vector<String> const& paths, Interpreter::Options const& options, size_t workers)
+{
+    auto start = Time::now_monotonic();
+    Batch batch { paths, {} };
+    batch.results.resize(paths.size());
+
+    // Interpreters are only ever used by the thread they're handed to, so they can all be set up here.
+    Vector<Worker> pool;
+    pool.ensure_capacity(workers);
+    for (size_t i = 0; i < min(workers, max(paths.size(), 1ul)); ++i) {
+        auto interpreter = Interpreter::create(options);
+        if (interpreter.is_error()) {
+            warnln("{}", interpreter.error());
+            return 1;
+        }
+        pool.append({ &batch, interpreter.release_value() });
+    }
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, Interpreter::thread_stack_size);
+    size_t started = 0;
+    for (auto& worker : pool) {
+        if (auto rc = pthread_create(&worker.thread, &attributes, run_worker, &worker); rc != 0) {
+            warnln("Failed to start a worker: {}", strerror(rc));
+            break;
+        }
+        ++started;
+    }
+    pthread_attr_destroy(&attributes);
+    if (started == 0)
+        return 1;
+
+    // Results are reported in order, each as soon as it and every one before it are in.
+    OutputBuffer report;
+    size_t failures = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        pthread_mutex_lock(&batch.mutex);
+        if (!batch.results[i].done)
+            report.flush();
+        while (!batch.results[i].done)
+            pthread_cond_wait(&batch.result_ready, &batch.mutex);
+        auto result = batch.results[i];
+        pthread_mutex_unlock(&batch.mutex);
+
+        report.appendff("==> {} (status {}, {} us)", paths[i], result.status, result.elapsed_ns / 1000);
+        report.end_line();
+        copy_output(result.output_fd, report);
+        if (result.status != 0)
+            ++failures;
+    }
+
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(pool[i].thread, nullptr);
+
+    report.flush();
+    warnln("{} scripts, {} failed, {} ms on {} threads", paths.size(), failures, (Time::now_monotonic() - start).to_milliseconds(), started);
+    return failures == 0 ? 0 : 1;
+}
+
+Optional<Vector<String>> read_manifest(char const* path)
+{
+    auto file = MappedFile::map(path);
+    if (!file) {
+        warnln("Failed to open {}: {}", path, strerror(errno));
+        return {};
+    }
+
+    Vector<String> paths;
+    for (auto line : file->bytes().split_view('\n')) {
+        line = line.trim_whitespace();
+        if (!line.is_empty() && !line.starts_with('#'))
+            paths.append(line);
+    }
+    return paths;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "interpreter.h"
+
+// Runs every script in `paths` in a context of its own, on `workers` threads that each have an interpreter of their own.
+// What a script prints, and any error it runs into, is captured and written to stdout in the order of `paths`, after a
+// line with its path, exit status and running time; a summary follows on stderr. Returns 1 if any script failed.
+int run_batch(Vector<String> const& paths, Interpreter::Options const&, size_t workers);
+
+// The paths listed in the manifest at `path`, one per line; blank lines and lines starting with `#` are skipped.
+Optional<Vector<String>> read_manifest(char const* path);
@@ -0,0 +1,1008 @@
+#include "builtins.h"
+#include "ast.h"
+#include "event_loop.h"
+#include "memo.h"
+#include "sequence.h"
+#include <AK/Checked.h>
+#include <AK/Format.h>
+#include <AK/Function.h>
+#include <AK/Random.h>
+#include <AK/StringView.h>
+#include <AK/TypeCasts.h>
+#include <errno.h>
+#include <string.h>
+
+Value lang$print(Context& context, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    auto& output = *context.output;
+    bool first = true;
+    Function<void(Value const&)> print_value = [&](Value const& value) {
+        value.value.visit(
+            [&](Empty) { output.append("<empty>"sv); },
+            [&](FunctionValue const&) { output.append("<fn ref>"sv); }, // FIXME
+            [&](NonnullRefPtr<Type> const& type) {
+                if (type->decl.has<NativeType>()) {
+                    switch (type->decl.get<NativeType>()) {
+                    case NativeType::Int:
+                        output.append("int"sv);
+                        break;
+                    case NativeType::String:
+                        output.append("string"sv);
+                        break;
+                    case NativeType::Any:
+                        output.append("any"sv);
+                        break;
+                    }
+                } else {
+                    auto& rec = type->decl.get<Vector<TypeName>>();
+                    output.append("record {"sv);
+                    for (auto& entry : rec) {
+                        output.appendff(" {}: ", entry.name);
+                        print_value({ entry.type });
+                    }
+                    output.append(" }"sv);
+                }
+            },
+            [&](NonnullRefPtr<CommentResolutionSet> const& rs) {
+                output.append("<Comment resolution set: {"sv);
+                auto first = true;
+                for (auto& entry : rs->materialize(context)) {
+                    if (!first)
+                        output.append(", "sv);
+                    first = false;
+                    print_value(entry);
+                }
+                output.append("}>"sv);
+            },
+            [&](NativeFunctionType const& fnptr) { output.appendff("<fnptr at {:p}>", fnptr.fn); },
+            [&](RecordValue const& rv) {
+                output.append('(');
+                auto first = true;
+                for (auto& entry : rv.members->values) {
+                    if (!first)
+                        output.append(' ');
+                    first = false;
+                    print_value(entry);
+                }
+                output.append(')');
+            },
+            [&](String const& string) { output.append(string); },
+            [&](MappedString const& string) { output.append(string.view()); },
+            [&](NonnullRefPtr<Sequence> const&) { output.append("<sequence>"sv); },
+            [&](auto const& value) { output.appendff("{}", value); });
+    };
+    for (auto& arg : args) {
+        if (!first)
+            output.append(' ');
+        print_value(arg);
+        first = false;
+    }
+    output.end_line();
+    return { Empty {} };
+}
+
+Value lang$flush(Context& context, void*, size_t)
+{
+    context.output->flush();
+    return { Empty {} };
+}
+
+template<typename T>
+static constexpr bool is_string_like = IsSame<T, String> || IsSame<T, MappedString>;
+
+static StringView view_of(String const& string) { return string; }
+static StringView view_of(MappedString const& string) { return string.view(); }
+
+// Folds two strings, at least one of them mapped, by views of their characters rather than by copies of the mapped ones.
+// Returns false for operators that don't compare strings, which then see the mapped ones as copies.
+template<typename Operator, typename U, typename T>
+static bool fold_strings(auto& accumulator, U const& a, T const& b)
+{
+    auto a_view = view_of(a);
+    auto b_view = view_of(b);
+    if constexpr (requires { Operator::compare(a_view, b_view); }) {
+        accumulator = Operator::compare(a_view, b_view);
+        return true;
+    } else if constexpr (requires { Operator::keeps_first(a_view, b_view); }) {
+        if (!Operator::keeps_first(a_view, b_view))
+            accumulator = b;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+template<typename Operator>
+static void fold_append(Context& context, auto& accumulator, auto&& arg)
+{
+    Variant<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NativeFunctionType, RecordValue, MappedString, NonnullRefPtr<Sequence>> value { Empty {} };
+    if constexpr (requires { arg.template has<NumberType>(); }) {
+        if (arg.template has<NonnullRefPtr<CommentResolutionSet>>()) {
+            auto& set = *arg.template get<NonnullRefPtr<CommentResolutionSet>>();
+            for (auto& entry : set.materialize(context))
+                fold_append<Operator>(context, accumulator, entry.value);
+            return;
+        } else {
+            value = arg.template downcast<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NativeFunctionType, RecordValue, MappedString, NonnullRefPtr<Sequence>>();
+        }
+    } else if constexpr (IsSame<RemoveCVReference<decltype(arg)>, NumberType> || IsSame<RemoveCVReference<decltype(arg)>, String>) {
+        value = arg;
+    }
+
+    accumulator.visit(
+        [&](Empty) {
+            accumulator = value.template downcast<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NonnullRefPtr<CommentResolutionSet>, NativeFunctionType, RecordValue, MappedString, NonnullRefPtr<Sequence>>();
+        },
+        [&]<typename U>(U const& accumulator_value) {
+            value.visit(
+                [&]<typename T>(T const& value) {
+                    if constexpr (is_string_like<U> && is_string_like<T> && !(IsSame<U, String> && IsSame<T, String>)) {
+                        if (fold_strings<Operator>(accumulator, accumulator_value, value))
+                            return;
+                        if constexpr (IsCallableWithArguments<Operator, String, String>)
+                            accumulator = Operator {}(String(view_of(accumulator_value)), String(view_of(value)));
+                    } else if constexpr (IsSame<T, MappedString> && IsCallableWithArguments<Operator, U, String>) {
+                        accumulator = Operator {}(accumulator_value, String(value.view()));
+                    } else if constexpr (IsSame<U, MappedString> && IsCallableWithArguments<Operator, String, T>) {
+                        accumulator = Operator {}(String(accumulator_value.view()), value);
+                    } else if constexpr (IsCallableWithArguments<Operator, U, T>) {
+                        accumulator = Operator {}(accumulator_value, value);
+                    }
+                });
+        });
+};
+
+template<typename Operator>
+Value lang$fold_op(Context& context, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    Variant<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NonnullRefPtr<CommentResolutionSet>, NativeFunctionType, RecordValue, MappedString, NonnullRefPtr<Sequence>> accumulator { Empty {} };
+    for (auto& arg : args)
+        fold_append<Operator>(context, accumulator, arg.value);
+    return { accumulator };
+}
+
+static void add_append(Context& context, auto& accumulator, auto&& arg)
+{
+    Variant<Empty, NumberType, String> value { Empty {} };
+    if constexpr (requires { arg.template has<NumberType>(); }) {
+        if (arg.template has<Empty>() || arg.template has<NumberType>() || arg.template has<String>())
+            value = arg.template downcast<Empty, NumberType, String>();
+        else if (arg.template has<NonnullRefPtr<CommentResolutionSet>>()) {
+            for (auto& entry : arg.template get<NonnullRefPtr<CommentResolutionSet>>()->materialize(context))
+                add_append(context, accumulator, entry.value);
+            return;
+        }
+    } else {
+        value = arg;
+    }
+
+    if (accumulator.template has<Empty>()) {
+        accumulator = value;
+    } else if (accumulator.template has<String>()) {
+        if (!value.template has<Empty>()) {
+            StringBuilder builder;
+            builder.append(accumulator.template get<String>());
+            value.visit([&](auto& x) { builder.appendff("{}", x); }, [](Empty) {});
+            accumulator = builder.build();
+        }
+    } else if (accumulator.template has<NumberType>()) {
+        if (value.template has<NumberType>()) {
+            accumulator = accumulator.template get<NumberType>() + value.template get<NumberType>();
+        } else if (value.template has<String>()) {
+            StringBuilder builder;
+            value.visit([&](auto& x) { builder.appendff("{}", x); }, [](Empty) {});
+            builder.append(value.get<String>());
+            accumulator = builder.build();
+        }
+    }
+};
+
+Value lang$add(Context& context, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    Variant<Empty, NumberType, String> accumulator { Empty {} };
+    for (auto& arg : args) {
+        arg.value.visit(
+            [&](Empty) { add_append(context, accumulator, String("<empty>"sv)); },
+            [&](FunctionValue const&) { add_append(context, accumulator, String("<function>"sv)); },
+            [&](NonnullRefPtr<Type> const&) { add_append(context, accumulator, String("<type>"sv)); },
+            [&](NonnullRefPtr<CommentResolutionSet> const& crs) {
+                for (auto& entry : crs->materialize(context))
+                    add_append(context, accumulator, entry.value);
+            },
+            [&](NativeFunctionType const&) { add_append(context, accumulator, String("<fn>"sv)); },
+            [&](RecordValue const& rv) { add_append(context, accumulator, String("<record>"sv)); },
+            [&](MappedString const& string) { add_append(context, accumulator, String(string.view())); },
+            [&](NonnullRefPtr<Sequence> const&) { add_append(context, accumulator, String("<sequence>"sv)); },
+            [&](auto const& value) { add_append(context, accumulator, value); });
+    }
+    if (auto string = accumulator.get_pointer<String>())
+        context.track(*string);
+    return { move(accumulator).downcast<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NonnullRefPtr<CommentResolutionSet>, NativeFunctionType, RecordValue, MappedString, NonnullRefPtr<Sequence>>() };
+}
+
+bool truth(Context& context, Value const& condition)
+{
+    return condition.value.visit(
+        [](Empty) -> bool { return false; },
+        [](FunctionValue const&) -> bool { return true; },
+        [](NonnullRefPtr<Type> const&) -> bool { return true; },
+        [&](NonnullRefPtr<CommentResolutionSet> const& crs) -> bool {
+            // Stops computing a deferred set's values at the first falsey one.
+            for (size_t i = 0; i < crs->size(); ++i) {
+                if (!truth(context, crs->at(context, i)))
+                    return false;
+            }
+            return true;
+        },
+        [](NativeFunctionType const&) -> bool { return true; },
+        [](RecordValue const&) { return true; },
+        [](auto const& value) -> bool {
+            if constexpr (requires { (bool)value; })
+                return (bool)value;
+            else if constexpr (requires { value.is_empty(); })
+                return !value.is_empty();
+            else
+                return true;
+        });
+}
+
+Value& flatten(Value& input)
+{
+    if (auto ptr = input.value.get_pointer<NonnullRefPtr<CommentResolutionSet>>()) {
+        if ((*ptr)->size() == 1 && !(*ptr)->deferred)
+            return flatten((*ptr)->values.first());
+    }
+
+    return input;
+}
+
+Value lang$cond(Context& context, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    size_t i = 0;
+    for (; i + 1 < count; i += 2) {
+        auto& condition = args[i];
+        auto& value = args[i + 1];
+        if (truth(context, condition))
+            return value;
+    }
+    if (i < count)
+        return args[count - 1];
+
+    return { Empty {} };
+}
+
+Value lang$cond_lazy(Context& context, Span<NonnullRefPtr<ASTNode> const> args)
+{
+    size_t i = 0;
+    for (; i + 1 < args.size(); i += 2) {
+        if (truth(context, args[i]->run(context)))
+            return args[i + 1]->run(context);
+    }
+    if (i < args.size())
+        return args.last()->run(context);
+
+    return { Empty {} };
+}
+
+Value lang$is(Context&, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto& value = args[0];
+    if (!value.value.has<FunctionValue>())
+        return { Empty {} };
+
+    auto& query = args[1];
+    if (!query.value.has<String>())
+        return { Empty {} };
+
+    auto words = query.value.get<String>().split(' ');
+
+    auto& fn = value.value.get<FunctionValue>();
+    Vector<bool> found;
+    found.resize(words.size());
+
+    for (auto entry : fn.node->body()) {
+        auto const* ptr = entry.ptr();
+        if (is<Statement>(*entry))
+            ptr = static_cast<Statement const*>(ptr)->node().ptr();
+
+        if (!is<Comment>(*ptr))
+            continue;
+
+        auto comment = static_cast<Comment const*>(ptr);
+        for (auto it = words.begin(); it != words.end(); ++it) {
+            if (found[it.index()])
+                continue;
+            if (comment->text().contains(*it))
+                found[it.index()] = true;
+        }
+
+        if (all_of(found, [](auto x) { return x; }))
+            break;
+    }
+
+    if (all_of(found, [](auto x) { return x; }))
+        return { 1 };
+
+    return { 0 };
+}
+
+Value lang$loop(Context& context, void* ptr, size_t count)
+{
+    // loop(start, step_fn, stop_cond) :: v=start; while(!stop_cond(v)) v = step_cond(v); return v;
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 3)
+        return { Empty {} };
+
+    auto value = args[0];
+    auto& step = args[1];
+    auto& stop = args[2];
+
+    // The usual step and stop closures are tiny, and calling them through Call would dominate the loop.
+    auto inline_step = InlineCall::create(context, step);
+    auto inline_stop = InlineCall::create(context, stop);
+
+    auto step_fn = [&] {
+        if (inline_step.has_value()) {
+            value = inline_step->call(context, value);
+            return;
+        }
+        value = make_ref_counted<Call>(
+            static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(step)),
+            Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(value)) })
+                    ->run(context);
+    };
+
+    auto stop_fn = [&] {
+        if (inline_stop.has_value())
+            return truth(context, inline_stop->call(context, value));
+        auto res = make_ref_counted<Call>(
+            static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(stop)),
+            Vector { static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(value)) })
+                       ->run(context);
+        return truth(context, res);
+    };
+
+    auto start = context.tracer ? Tracer::now() : 0;
+    size_t iterations = 0;
+    while (!context.error.has_value() && !stop_fn()) {
+        ++iterations;
+        step_fn();
+    }
+    context.statistics.loop_iterations += iterations;
+    if (context.tracer)
+        context.tracer->complete("loop"sv, "loop"sv, start, String::formatted("\"iterations\":{}", iterations));
+
+    return value;
+}
+
+Value lang$stats(Context& context, void*, size_t)
+{
+    return context.statistics.to_value(*context.heap);
+}
+
+Value lang$memo(Context& context, void* ptr, size_t count)
+{
+    // memo(fn, capacity?, check_purity?) :: fn, with its results cached by argument
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.is_empty())
+        return { Empty {} };
+
+    auto function = flatten(args[0]).value.get_pointer<FunctionValue>();
+    if (!function)
+        return { Empty {} };
+
+    auto capacity = MemoizedCall::default_capacity;
+    if (args.size() > 1) {
+        if (auto number = flatten(args[1]).value.get_pointer<NumberType>(); number && number->to<i64>() > 0)
+            capacity = number->to<i64>();
+    }
+
+    if (args.size() > 2 && truth(context, args[2]) && !may_memoize(*function)) {
+        context.error = String::formatted("{} prints or changes values in place, refusing to memoize it", function->node->name());
+        return { Empty {} };
+    }
+
+    return { MemoizedCall::wrap(*function, capacity) };
+}
+
+Value lang$get(Context& context, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto& index = flatten(args[0]).value;
+    auto& subject = flatten(args[1]);
+
+    return index.visit(
+        [&](NumberType index) {
+            return subject.value.visit(
+                [&](String const& str) {
+                    return Value { context.track(String::repeated(str[index.to_size()], 1)) };
+                },
+                [&](MappedString const& str) {
+                    if (index.to_size() >= str.length)
+                        return Value { Empty {} };
+                    return Value { context.track(String::repeated(str.view()[index.to_size()], 1)) };
+                },
+                [&](auto&) {
+                    return Value { Empty {} };
+                });
+        },
+        [&](String& field) {
+            return make_ref_counted<MemberAccess>(field, static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(subject)))->run(context);
+        },
+        [](auto&) { return Value { Empty {} }; });
+}
+
+Value lang$slice(Context& context, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 3)
+        return { Empty {} };
+
+    auto index = flatten(args[0]).value.get_pointer<NumberType>();
+    auto size = flatten(args[1]).value.get_pointer<NumberType>();
+    auto& subject = flatten(args[2]);
+
+    if (!index || !size)
+        return { Empty {} };
+
+    // Slices of a mapped file view it in place.
+    if (auto mapped = subject.value.get_pointer<MappedString>())
+        return { mapped->substring(index->to_size(), size->to_size()) };
+
+    auto string = subject.value.get_pointer<String>();
+    if (!string)
+        return { Empty {} };
+
+    return { context.track(string->substring(index->to_size(), size->to_size())) };
+}
+
+Value lang$map_file(Context& context, void* ptr, size_t count)
+{
+    // map_file(path) :: the contents of the file at path, read in only as they're used
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.is_empty())
+        return { Empty {} };
+
+    auto path = flatten(args[0]).value.get_pointer<String>();
+    if (!path)
+        return { Empty {} };
+
+    auto file = MappedFile::map(*path);
+    if (!file) {
+        context.error = String::formatted("Failed to map {}: {}", *path, strerror(errno));
+        return { Empty {} };
+    }
+    auto length = file->bytes().length();
+    return { MappedString { file.release_nonnull(), 0, length } };
+}
+
+static EventLoop* event_loop_of(Context& context)
+{
+    if (!context.event_loop && !context.error.has_value())
+        context.error = String { "Timers and file reads can't be started here" };
+    return context.event_loop;
+}
+
+Value lang$after(Context& context, void* ptr, size_t count)
+{
+    // after(milliseconds fn) :: calls fn once milliseconds have passed, after the script and anything due earlier
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto milliseconds = flatten(args[0]).value.get_pointer<NumberType>();
+    if (!milliseconds)
+        return { Empty {} };
+
+    if (auto event_loop = event_loop_of(context))
+        event_loop->add_timer(context, milliseconds->to_size(), args[1]);
+    return { Empty {} };
+}
+
+Value lang$read_file(Context& context, void* ptr, size_t count)
+{
+    // read_file(path fn) :: calls fn with the contents of the file at path once they've been read, without waiting for them
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto path = flatten(args[0]).value.get_pointer<String>();
+    if (!path)
+        return { Empty {} };
+
+    if (auto event_loop = event_loop_of(context))
+        event_loop->read_file(context, *path, args[1]);
+    return { Empty {} };
+}
+
+Value lang$chunk(Context& context, void* ptr, size_t count)
+{
+    // chunk(n size subject) :: the n-th run of size characters in subject, or nothing past its end
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 3)
+        return { Empty {} };
+
+    auto index = flatten(args[0]).value.get_pointer<NumberType>();
+    auto size = flatten(args[1]).value.get_pointer<NumberType>();
+    if (!index || !size || size->to_size() == 0)
+        return { Empty {} };
+
+    Checked<size_t> start = index->to_size();
+    start *= size->to_size();
+    auto& subject = flatten(args[2]);
+    if (auto mapped = subject.value.get_pointer<MappedString>()) {
+        if (start.has_overflow() || start.value() >= mapped->length)
+            return { Empty {} };
+        return { mapped->substring(start.value(), size->to_size()) };
+    }
+    if (auto string = subject.value.get_pointer<String>()) {
+        if (start.has_overflow() || start.value() >= string->length())
+            return { Empty {} };
+        return { context.track(string->substring(start.value(), min(size->to_size(), string->length() - start.value()))) };
+    }
+    return { Empty {} };
+}
+
+Value lang$split_line(Context& context, void* ptr, size_t count)
+{
+    // split_line(subject) :: (line rest), splitting subject after its first line; nothing once subject is empty
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.is_empty())
+        return { Empty {} };
+
+    auto split = [&](StringView string, auto make_value) -> Value {
+        if (string.is_empty())
+            return { Empty {} };
+        auto newline = string.find('\n');
+        auto line_length = newline.value_or(string.length());
+        auto rest_start = newline.has_value() ? line_length + 1 : line_length;
+
+        auto string_type = make_ref_counted<Type>(NativeType::String);
+        Vector<TypeName> types;
+        types.append({ .name = "line", .type = string_type });
+        types.append({ .name = "rest", .type = string_type });
+        return { RecordValue::create(
+            make_ref_counted<Type>(move(types)),
+            { make_value(0, line_length), make_value(rest_start, string.length() - rest_start) }) };
+    };
+
+    auto& subject = flatten(args[0]);
+    if (auto mapped = subject.value.get_pointer<MappedString>())
+        return split(mapped->view(), [&](size_t start, size_t length) { return Value { mapped->substring(start, length) }; });
+    if (auto string = subject.value.get_pointer<String>())
+        return split(string->view(), [&](size_t start, size_t length) { return Value { context.track(string->substring(start, length)) }; });
+    return { Empty {} };
+}
+
+Value lang$range(Context&, void* ptr, size_t count)
+{
+    // range(end) / range(start end) / range(start end step) :: start (or 0), start + step, ... up to but not including end
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.is_empty() || args.size() > 3)
+        return { Empty {} };
+
+    i64 bounds[3] { 0, 0, 1 };
+    for (size_t i = 0; i < args.size(); ++i) {
+        auto number = flatten(args[i]).value.get_pointer<NumberType>();
+        if (!number)
+            return { Empty {} };
+        bounds[args.size() == 1 ? 1 : i] = number->to<i64>();
+    }
+    if (bounds[2] == 0)
+        return { Empty {} };
+
+    return { make_ref_counted<Sequence>(Sequence::Range { bounds[0], bounds[1], bounds[2] }, Vector<Sequence::Stage> {}) };
+}
+
+Value lang$generate(Context&, void* ptr, size_t count)
+{
+    // generate(seed step) :: seed, step(seed), step(step(seed)), ... up to the first empty value
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    return { make_ref_counted<Sequence>(Sequence::Generator { args[0], args[1] }, Vector<Sequence::Stage> {}) };
+}
+
+static Value with_stage(Value& subject, Sequence::Stage stage)
+{
+    auto sequence = as_sequence(flatten(subject));
+    if (!sequence)
+        return { Empty {} };
+
+    auto stages = sequence->stages;
+    stages.append(move(stage));
+    return { make_ref_counted<Sequence>(sequence->source, move(stages)) };
+}
+
+Value lang$map(Context&, void* ptr, size_t count)
+{
+    // map(fn sequence) :: fn of each value of sequence
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    return with_stage(args[1], { Sequence::StageKind::Map, args[0] });
+}
+
+Value lang$filter(Context&, void* ptr, size_t count)
+{
+    // filter(fn sequence) :: the values of sequence that fn is true of
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    return with_stage(args[1], { Sequence::StageKind::Filter, args[0] });
+}
+
+Value lang$take(Context&, void* ptr, size_t count)
+{
+    // take(n sequence) :: the first n values of sequence
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto number = flatten(args[0]).value.get_pointer<NumberType>();
+    if (!number)
+        return { Empty {} };
+
+    return with_stage(args[1], { Sequence::StageKind::Take, Value { Empty {} }, static_cast<size_t>(max(number->to<i64>(), 0)) });
+}
+
+Value lang$fold(Context& context, void* ptr, size_t count)
+{
+    // fold(fn init sequence) :: fn(...fn(fn(init first) second)... last)
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 3)
+        return { Empty {} };
+
+    auto sequence = as_sequence(flatten(args[2]));
+    if (!sequence)
+        return { Empty {} };
+
+    ElementCall call { context, args[0] };
+    SequenceIterator iterator { context, sequence.release_nonnull() };
+    auto accumulator = args[1];
+    for (;;) {
+        auto value = iterator.next();
+        if (!value.has_value())
+            return accumulator;
+        accumulator = call.call(context, move(accumulator), value.release_value());
+    }
+}
+
+Value lang$each(Context& context, void* ptr, size_t count)
+{
+    // each(fn sequence) :: calls fn on each value of sequence, in order
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto sequence = as_sequence(flatten(args[1]));
+    if (!sequence)
+        return { Empty {} };
+
+    ElementCall call { context, args[0] };
+    SequenceIterator iterator { context, sequence.release_nonnull() };
+    for (;;) {
+        auto value = iterator.next();
+        if (!value.has_value())
+            return { Empty {} };
+        call.call(context, value.release_value());
+    }
+}
+
+Value lang$typeof(Context&, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() != 1)
+        return { Empty {} };
+
+    return { type_from(args[0]) };
+}
+
+Value lang$append(Context&, void* ptr, size_t count)
+{
+    Span<Value> args { reinterpret_cast<Value*>(ptr), count };
+    if (args.size() < 2)
+        return { Empty {} };
+
+    auto& value = flatten(args[0]);
+    auto subject = flatten(args[1]);
+
+    if (!subject.value.has<RecordValue>())
+        return subject;
+
+    auto& rv = subject.value.get<RecordValue>();
+    auto types_ptr = rv.type->decl.get_pointer<Vector<TypeName>>();
+    if (!types_ptr)
+        return subject;
+
+    auto last_name = types_ptr->is_empty() ? String("_"sv) : types_ptr->last().name;
+    size_t field = 0;
+    if (sscanf(last_name.characters(), "_%zu", &field) != 1)
+        field = types_ptr->size();
+
+    rv.type->append_member({ String::formatted("_{}", field + 1), type_from(value) });
+    auto members = rv.members->values;
+    members.append(value);
+    rv.members = make_ref_counted<RecordMembers>(move(members));
+
+    if (types_ptr->first().name == "length" && types_ptr->first().type->decl.has<NativeType>())
+        rv.members->values.first() = { rv.members->values.first().value.get<NumberType>() + NumberType(u64(1)) };
+    return subject;
+}
+
+struct Sub {
+    NumberType operator()(NumberType a, NumberType b) { return a - b; }
+    NumberType operator()(String const&, String const&) { return (u64)0; }
+};
+
+struct Mul {
+    NumberType operator()(NumberType a, NumberType b) { return a * b; }
+    NumberType operator()(String const&, String const&) { return (u64)0; }
+};
+
+struct Div {
+    NumberType operator()(NumberType a, NumberType b) { return a / b; }
+    NumberType operator()(String const&, String const&) { return (u64)0; }
+};
+
+struct Mod {
+    NumberType operator()(NumberType a, NumberType b) { return a % b; }
+    NumberType operator()(String const&, String const&) { return (u64)0; }
+};
+
+static int compare_strings(StringView a, StringView b)
+{
+    if (auto result = memcmp(a.characters_without_null_termination(), b.characters_without_null_termination(), min(a.length(), b.length())))
+        return result;
+    return a.length() < b.length() ? -1 : a.length() > b.length();
+}
+
+struct Greater {
+    NumberType operator()(NumberType a, NumberType b) { return a > b; }
+    NumberType operator()(String const& a, String const& b) { return a > b; }
+    static NumberType compare(StringView a, StringView b) { return u64(compare_strings(a, b) > 0); }
+};
+
+struct Equal {
+    NumberType operator()(NumberType a, NumberType b) { return a == b; }
+    NumberType operator()(String const& a, String const& b) { return u64(a == b); }
+    static NumberType compare(StringView a, StringView b) { return u64(a == b); }
+    NumberType operator()(NonnullRefPtr<Type> const& a, NonnullRefPtr<Type> const& b)
+    {
+        if (a.ptr() == b.ptr())
+            return true;
+
+        if (auto ptr = a->decl.get_pointer<NativeType>()) {
+            auto b_ptr = b->decl.get_pointer<NativeType>();
+            return b_ptr && *ptr == *b_ptr;
+        }
+
+        if (b->decl.has<NativeType>())
+            return false;
+
+        auto& a_type = a->decl.get<Vector<TypeName>>();
+        auto& b_type = b->decl.get<Vector<TypeName>>();
+        if (a_type.size() != b_type.size())
+            return false;
+
+        return all_of(a_type, [&b_type, i = size_t { 0 }](auto& a) {
+            auto& b = b_type[const_cast<size_t&>(i)++];
+            return a.name == b.name && Equal {}(a.type, b.type).template to<bool>();
+        });
+    }
+};
+
+struct Flat {
+    template<typename T>
+    T operator()(T a, T b)
+    {
+        if (get_random<bool>())
+            return a;
+        return b;
+    }
+};
+
+struct Max {
+    NumberType operator()(NumberType a, NumberType b)
+    {
+        return Number::map([](auto a, auto b) -> Number { return max(a, b); }, a, b);
+    }
+    String operator()(String const& a, String const& b) { return max(a, b); }
+    String operator()(NumberType a, String const& b)
+    {
+        return max(Number::map([](auto a) { return String::number(a); }, a), b);
+    }
+    String operator()(String const& a, NumberType b) { return this->operator()(b, a); }
+    // As max() does, keeps the first of two equal strings.
+    static bool keeps_first(StringView a, StringView b) { return compare_strings(a, b) >= 0; }
+};
+
+struct Min {
+    NumberType operator()(NumberType a, NumberType b)
+    {
+        return Number::map([](auto a, auto b) -> Number { return min(a, b); }, a, b);
+    }
+    String operator()(String const& a, String const& b) { return min(a, b); }
+    String operator()(NumberType a, String const& b)
+    {
+        return min(Number::map([](auto a) { return String::number(a); }, a), b);
+    }
+    String operator()(String const& a, NumberType b) { return this->operator()(b, a); }
+    // As min() does, keeps the second of two equal strings.
+    static bool keeps_first(StringView a, StringView b) { return compare_strings(a, b) < 0; }
+};
+
+static constexpr Builtin s_builtins[] {
+    { "print"sv, lang$print, comment_words("print function native operation"sv), false, true },
+    { "flush"sv, lang$flush, comment_words("native output flush operation"sv), false, true },
+    { "add"sv, lang$add, comment_words("native arithmetic addition operation"sv), true },
+    { "sub"sv, lang$fold_op<Sub>, comment_words("native arithmetic subtract operation"sv), true },
+    { "mul"sv, lang$fold_op<Mul>, comment_words("native arithmetic multiply operation"sv), true },
+    { "div"sv, lang$fold_op<Div>, comment_words("native arithmetic divide operation"sv), true },
+    { "mod"sv, lang$fold_op<Mod>, comment_words("native arithmetic modulus operation"sv), true },
+    { "cond"sv, lang$cond, comment_words("native conditional selection operation"sv), true, false, lang$cond_lazy },
+    { "is"sv, lang$is, comment_words("native comment query operation"sv) },
+    { "loop"sv, lang$loop, comment_words("native loop flow operation"sv) },
+    { "gt"sv, lang$fold_op<Greater>, comment_words("native comparison greater_than operation"sv), true },
+    { "eq"sv, lang$fold_op<Equal>, comment_words("native comparison equality operation"sv), true },
+    { "max"sv, lang$fold_op<Max>, comment_words("native comparison maximum operation"sv), true },
+    { "min"sv, lang$fold_op<Min>, comment_words("native comparison minimum operation"sv), true },
+    { "collapse"sv, lang$fold_op<Flat>, comment_words("native probability collapse flatten operation"sv) },
+    { "get"sv, lang$get, comment_words("native indexing operation"sv) },
+    { "slice"sv, lang$slice, comment_words("native string slicing operation"sv) },
+    { "chunk"sv, lang$chunk, comment_words("native text chunk slicing operation"sv) },
+    { "split_line"sv, lang$split_line, comment_words("native text line split operation"sv) },
+    { "map_file"sv, lang$map_file, comment_words("native file view input operation"sv) },
+    { "read_file"sv, lang$read_file, comment_words("native file read input event operation"sv), false, true },
+    { "after"sv, lang$after, comment_words("native event timer operation"sv), false, true },
+    { "append"sv, lang$append, comment_words("native meta append operation"sv), false, true },
+    { "typeof"sv, lang$typeof, comment_words("native meta typeof operation"sv) },
+    { "stats"sv, lang$stats, comment_words("native meta runtime statistics operation"sv) },
+    { "memo"sv, lang$memo, comment_words("native meta memoize cache operation"sv) },
+    { "range"sv, lang$range, comment_words("native sequence range operation"sv) },
+    { "generate"sv, lang$generate, comment_words("native sequence generate operation"sv) },
+    { "map"sv, lang$map, comment_words("native sequence map operation"sv) },
+    { "filter"sv, lang$filter, comment_words("native sequence filter operation"sv) },
+    { "take"sv, lang$take, comment_words("native sequence take operation"sv) },
+    { "fold"sv, lang$fold, comment_words("native sequence fold reduce operation"sv) },
+    { "each"sv, lang$each, comment_words("native sequence each iteration operation"sv) },
+};
+
+static constexpr size_t builtin_count = sizeof(s_builtins) / sizeof(s_builtins[0]);
+
+// DirectMention tracks shadowed builtins in a single u64.
+static_assert(builtin_count <= 64);
+
+struct BuiltinHashTable {
+    static constexpr size_t size = 128;
+    static_assert(size >= builtin_count * 2);
+
+    u32 seed { 0 };
+    // Index into s_builtins plus one, or zero for an empty slot.
+    u8 slots[size] {};
+};
+
+static consteval BuiltinHashTable make_builtin_hash_table()
+{
+    for (u32 seed = 0; seed < 100000; ++seed) {
+        BuiltinHashTable table;
+        table.seed = seed;
+        bool collided = false;
+        for (size_t i = 0; i < builtin_count && !collided; ++i) {
+            auto& slot = table.slots[builtin_name_hash(s_builtins[i].name, seed) % BuiltinHashTable::size];
+            if (slot != 0)
+                collided = true;
+            slot = i + 1;
+        }
+        if (!collided)
+            return table;
+    }
+    VERIFY_NOT_REACHED();
+}
+
+static constexpr auto s_builtin_hash_table = make_builtin_hash_table();
+
+Span<Builtin const> builtins()
+{
+    return { s_builtins, builtin_count };
+}
+
+Builtin const* find_builtin(StringView name)
+{
+    auto slot = s_builtin_hash_table.slots[builtin_name_hash(name, s_builtin_hash_table.seed) % BuiltinHashTable::size];
+    if (slot == 0)
+        return nullptr;
+    auto& builtin = s_builtins[slot - 1];
+    if (builtin.name != name)
+        return nullptr;
+    return &builtin;
+}
+
+Builtin const* find_builtin(NativeFunction fn)
+{
+    for (auto& builtin : s_builtins) {
+        if (builtin.fn == fn)
+            return &builtin;
+    }
+    return nullptr;
+}
+
+bool has_integer_fast_path(NativeFunction fn, Vector<Value> const& arguments)
+{
+    if (fn == lang$add || fn == lang$fold_op<Sub>) {
+        if (arguments.is_empty())
+            return false;
+    } else if (fn == lang$fold_op<Greater> || fn == lang$fold_op<Equal>) {
+        if (arguments.size() != 2)
+            return false;
+    } else {
+        return false;
+    }
+
+    for (auto& argument : arguments) {
+        auto number = argument.value.get_pointer<NumberType>();
+        if (!number || !number->has<i64>())
+            return false;
+    }
+    return true;
+}
+
+Optional<Value> call_integer_fast_path(NativeFunction fn, Vector<Value> const& arguments)
+{
+    auto at = [&](size_t index) { return arguments[index].value.get<NumberType>().get<i64>(); };
+    if (fn == lang$fold_op<Greater>)
+        return Value { NumberType(u64(at(0) > at(1))) };
+    if (fn == lang$fold_op<Equal>)
+        return Value { NumberType(u64(at(0) == at(1))) };
+
+    auto result = at(0);
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        auto overflowed = fn == lang$add ? __builtin_add_overflow(result, at(i), &result) : __builtin_sub_overflow(result, at(i), &result);
+        if (overflowed)
+            return {};
+    }
+    return Value { NumberType(result) };
+}
+
+bool matches_all(Span<StringView const> comment_words, Vector<String> const& queries)
+{
+    for (auto& query : queries) {
+        auto found = false;
+        for (auto& word : comment_words) {
+            if (word.contains(query)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+void initialize_base(Context& context)
+{
+    context.scope.empend();
+    context.comment_scope.empend();
+    context.last_call_scope_start = 0;
+
+    // Natives are not bound here, lookups that miss every scope fall back to the builtin table.
+    auto& scope = context.scope.last();
+    scope.set("int", Value { make_ref_counted<Type>(NativeType::Int) });
+    scope.set("string", Value { make_ref_counted<Type>(NativeType::String) });
+    scope.set("any", Value { make_ref_counted<Type>(NativeType::Any) });
+}
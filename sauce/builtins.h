@@ -0,0 +1,75 @@
+#pragma once
+
+#include "types.h"
+#include <AK/Span.h>
+#include <AK/StringView.h>
+
+// The words of a native's describing comments, split at compile time so mentions never have to allocate to match them.
+struct CommentWords {
+    static constexpr size_t max_words = 8;
+
+    StringView words[max_words] {};
+    size_t count { 0 };
+
+    constexpr Span<StringView const> span() const { return { words, count }; }
+};
+
+consteval CommentWords comment_words(StringView text)
+{
+    CommentWords result;
+    auto characters = text.characters_without_null_termination();
+    size_t start = 0;
+    for (size_t i = 0; i <= text.length(); ++i) {
+        if (i != text.length() && characters[i] != ' ')
+            continue;
+        if (i > start) {
+            if (result.count == CommentWords::max_words)
+                VERIFY_NOT_REACHED();
+            result.words[result.count++] = StringView { characters + start, i - start };
+        }
+        start = i + 1;
+    }
+    return result;
+}
+
+struct Builtin {
+    StringView name;
+    NativeFunction fn;
+    CommentWords comment;
+    // Free of side effects, so calls on constant arguments may be evaluated ahead of time.
+    bool pure { false };
+    // Prints or changes its arguments in place, so calls can't be skipped or replayed.
+    bool has_side_effects { false };
+    LazyNativeFunction lazy_fn { nullptr };
+
+    Value value() const { return { NativeFunctionType { fn, comment.span(), lazy_fn } }; }
+};
+
+constexpr u32 builtin_name_hash(StringView name, u32 seed)
+{
+    // FNV-1a, seeded so that a collision-free seed can be searched for at compile time.
+    u32 hash = 2166136261u ^ seed;
+    auto characters = name.characters_without_null_termination();
+    for (size_t i = 0; i < name.length(); ++i) {
+        hash ^= static_cast<u8>(characters[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Span<Builtin const> builtins();
+Builtin const* find_builtin(StringView name);
+Builtin const* find_builtin(NativeFunction);
+
+// Integer-only versions of add, sub, gt and eq, for call sites that keep passing them nothing but i64s.
+// The fast path applies to a call exactly when `has_integer_fast_path` says so, and gives up if the result overflows.
+bool has_integer_fast_path(NativeFunction, Vector<Value> const& arguments);
+Optional<Value> call_integer_fast_path(NativeFunction, Vector<Value> const& arguments);
+
+// Whether `cond` takes `value` as true. Only as much of a deferred set is computed as is needed to tell.
+bool truth(Context&, Value const& value);
+
+// Queries never contain spaces, so a query is a substring of a comment exactly when it is a substring of one of its words.
+bool matches_all(Span<StringView const> comment_words, Vector<String> const& queries);
+
+void initialize_base(Context&);
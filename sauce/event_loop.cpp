@@ -0,0 +1,430 @@
+#include "event_loop.h"
+#include "ast.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// The wake fd is waited on under this id, which no event is given.
+static constexpr u64 wake_id = 0;
+
+static String contents_of(Vector<char> const& data)
+{
+    if (data.is_empty())
+        return String::empty();
+    return String { data.data(), data.size() };
+}
+
+Result<NonnullOwnPtr<EventLoop>, String> EventLoop::create()
+{
+    auto epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return String::formatted("Failed to create an event loop: {}", strerror(errno));
+
+    auto wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u64 = wake_id;
+    if (wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+        auto message = String::formatted("Failed to create an event loop: {}", strerror(errno));
+        if (wake_fd >= 0)
+            close(wake_fd);
+        close(epoll_fd);
+        return message;
+    }
+    return adopt_own(*new EventLoop(epoll_fd, wake_fd));
+}
+
+EventLoop::~EventLoop()
+{
+    if (m_reader_started) {
+        pthread_mutex_lock(&m_reader_lock);
+        m_reader_stopping = true;
+        pthread_cond_signal(&m_reader_wakeup);
+        pthread_mutex_unlock(&m_reader_lock);
+        pthread_join(m_reader, nullptr);
+    }
+    for (auto& entry : m_events) {
+        if (entry.value->fd >= 0 && entry.value->kind != Event::Kind::Watch)
+            close(entry.value->fd);
+    }
+    close(m_wake_fd);
+    close(m_epoll_fd);
+}
+
+Optional<u64> EventLoop::add(NonnullOwnPtr<Event> event, u32 epoll_events)
+{
+    auto id = m_next_id++;
+    auto fd = event->fd;
+    if (event->context)
+        ++m_pending.ensure(event->context);
+    m_events.set(id, move(event));
+    if (fd < 0)
+        return id;
+
+    epoll_event registration {};
+    registration.events = epoll_events;
+    registration.data.u64 = id;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &registration) < 0) {
+        auto error = errno;
+        remove(id);
+        errno = error;
+        return {};
+    }
+    return id;
+}
+
+void EventLoop::remove(u64 id)
+{
+    auto it = m_events.find(id);
+    if (it == m_events.end())
+        return;
+    auto& event = *it->value;
+    if (event.fd >= 0) {
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, event.fd, nullptr);
+        if (event.kind != Event::Kind::Watch)
+            close(event.fd);
+    }
+    if (event.context) {
+        auto pending = m_pending.find(event.context);
+        if (--pending->value == 0)
+            m_pending.remove(event.context);
+    }
+    m_events.remove(id);
+}
+
+static int create_timer(u64 milliseconds)
+{
+    auto fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    // A timer set to zero is disarmed instead, so one that's due right away goes off a nanosecond later.
+    itimerspec expiry {};
+    expiry.it_value.tv_sec = static_cast<time_t>(milliseconds / 1000);
+    expiry.it_value.tv_nsec = static_cast<long>(milliseconds % 1000) * 1'000'000 + (milliseconds == 0 ? 1 : 0);
+    timerfd_settime(fd, 0, &expiry, nullptr);
+    return fd;
+}
+
+bool EventLoop::add_timer(Context& context, u64 milliseconds, Value callback)
+{
+    auto fd = create_timer(milliseconds);
+    if (fd < 0) {
+        context.error = String::formatted("Failed to create a timer: {}", strerror(errno));
+        return false;
+    }
+
+    auto event = make<Event>();
+    event->kind = Event::Kind::Timer;
+    event->fd = fd;
+    event->context = &context;
+    event->callback = move(callback);
+    if (!add(move(event), EPOLLIN).has_value()) {
+        context.error = String::formatted("Failed to wait on a timer: {}", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::read_file(Context& context, String const& path, Value callback)
+{
+    auto fd = open(path.characters(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) < 0) {
+        context.error = String::formatted("Failed to open {}: {}", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    auto event = make<Event>();
+    event->context = &context;
+    event->callback = move(callback);
+    event->path = path;
+    // epoll takes regular files to always be ready, and refuses to wait on them.
+    if (S_ISREG(status.st_mode)) {
+        event->kind = Event::Kind::ThreadedRead;
+        auto id = add(move(event), 0);
+        if (!hand_to_reader(*id, fd)) {
+            remove(*id);
+            return false;
+        }
+        return true;
+    }
+
+    event->kind = Event::Kind::Read;
+    event->fd = fd;
+    if (!add(move(event), EPOLLIN).has_value()) {
+        context.error = String::formatted("Failed to wait on {}: {}", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::watch(int fd, Function<void()> callback)
+{
+    auto event = make<Event>();
+    event->kind = Event::Kind::Watch;
+    event->fd = fd;
+    event->function = move(callback);
+    // Loops on other threads may watch the same descriptor, only one of them needs to be woken up for it.
+    return add(move(event), EPOLLIN | EPOLLEXCLUSIVE).has_value();
+}
+
+void EventLoop::unwatch(int fd)
+{
+    for (auto& entry : m_events) {
+        if (entry.value->kind == Event::Kind::Watch && entry.value->fd == fd) {
+            remove(entry.key);
+            return;
+        }
+    }
+}
+
+Optional<u64> EventLoop::add_timeout(u64 milliseconds, Function<void()> callback)
+{
+    auto fd = create_timer(milliseconds);
+    if (fd < 0)
+        return {};
+
+    auto event = make<Event>();
+    event->kind = Event::Kind::Timeout;
+    event->fd = fd;
+    event->function = move(callback);
+    return add(move(event), EPOLLIN);
+}
+
+void EventLoop::cancel_timeout(u64 id)
+{
+    if (auto event = m_events.get(id); event.has_value() && event.value()->kind == Event::Kind::Timeout)
+        remove(id);
+}
+
+size_t EventLoop::pending(Context const& context) const
+{
+    return m_pending.get(&context).value_or(0);
+}
+
+void EventLoop::cancel(Context& context)
+{
+    Vector<u64> ids;
+    for (auto& entry : m_events) {
+        if (entry.value->context == &context)
+            ids.append(entry.key);
+    }
+    // Reads already handed to the reader thread are dropped once they finish.
+    for (auto id : ids)
+        remove(id);
+}
+
+void EventLoop::when_settled(Context& context, Function<void()> on_settled)
+{
+    m_on_settled.set(&context, move(on_settled));
+    settle(context);
+}
+
+void EventLoop::settle(Context& context)
+{
+    if (m_pending.contains(&context))
+        return;
+    auto it = m_on_settled.find(&context);
+    if (it == m_on_settled.end())
+        return;
+    auto on_settled = move(it->value);
+    m_on_settled.remove(&context);
+    on_settled();
+}
+
+bool EventLoop::run_once()
+{
+    if (m_events.is_empty())
+        return false;
+
+    epoll_event events[64];
+    auto count = epoll_wait(m_epoll_fd, events, 64, -1);
+    if (count < 0) {
+        if (errno == EINTR)
+            return true;
+        warnln("Failed to wait for events: {}", strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        auto id = events[i].data.u64;
+        if (id == wake_id)
+            handle_finished_reads();
+        else if (m_events.contains(id))
+            handle(id);
+    }
+    return true;
+}
+
+void EventLoop::handle(u64 id)
+{
+    auto& event = *m_events.get(id).value();
+    switch (event.kind) {
+    case Event::Kind::Timer: {
+        u64 expirations;
+        if (read(event.fd, &expirations, sizeof(expirations)) < 0)
+            return;
+        complete(id, {});
+        return;
+    }
+    case Event::Kind::Read:
+        read_available(id);
+        return;
+    case Event::Kind::Watch: {
+        // The callback may unwatch its own descriptor.
+        auto callback = move(event.function);
+        callback();
+        if (auto it = m_events.find(id); it != m_events.end())
+            it->value->function = move(callback);
+        return;
+    }
+    case Event::Kind::Timeout: {
+        auto callback = move(event.function);
+        remove(id);
+        callback();
+        return;
+    }
+    case Event::Kind::ThreadedRead:
+        VERIFY_NOT_REACHED();
+    }
+}
+
+void EventLoop::read_available(u64 id)
+{
+    auto& event = *m_events.get(id).value();
+    char buffer[64 * KiB];
+    for (;;) {
+        auto nread = read(event.fd, buffer, sizeof(buffer));
+        if (nread < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return;
+            event.context->error = String::formatted("Failed to read {}: {}", event.path, strerror(errno));
+            complete(id, {});
+            return;
+        }
+        if (nread == 0)
+            break;
+        event.data.append(buffer, nread);
+    }
+    auto contents = contents_of(event.data);
+    event.context->track(contents);
+    complete(id, { move(contents) });
+}
+
+void EventLoop::handle_finished_reads()
+{
+    u64 count;
+    (void)read(m_wake_fd, &count, sizeof(count));
+
+    Vector<FinishedRead> finished_reads;
+    pthread_mutex_lock(&m_reader_lock);
+    swap(finished_reads, m_finished_reads);
+    pthread_mutex_unlock(&m_reader_lock);
+
+    for (auto& finished : finished_reads) {
+        auto event = m_events.get(finished.id);
+        if (!event.has_value())
+            continue;
+        auto& context = *event.value()->context;
+        if (finished.error != 0) {
+            context.error = String::formatted("Failed to read {}: {}", event.value()->path, strerror(finished.error));
+            complete(finished.id, {});
+            continue;
+        }
+        auto contents = contents_of(finished.data);
+        context.track(contents);
+        complete(finished.id, { move(contents) });
+    }
+}
+
+void EventLoop::complete(u64 id, Vector<Value> arguments)
+{
+    auto& event = *m_events.get(id).value();
+    auto& context = *event.context;
+    auto callback = event.callback.release_value();
+    auto name = event.kind == Event::Kind::Timer ? "timer"sv : "read_file"sv;
+    remove(id);
+
+    {
+        Heap::Activation activation { *context.heap };
+        Vector<NonnullRefPtr<ASTNode>> argument_nodes;
+        for (auto& argument : arguments)
+            argument_nodes.append(make_ref_counted<SyntheticNode>(move(argument)));
+        arguments.clear();
+        auto callee = make_ref_counted<SyntheticNode>(move(callback));
+        // The call itself is traced and profiled like any other; this covers the callback as a whole.
+        auto start = context.tracer ? Tracer::now() : 0;
+        make_ref_counted<Call>(move(callee), move(argument_nodes))->run(context);
+        if (context.tracer)
+            context.tracer->complete("event"sv, name, start);
+    }
+
+    if (context.error.has_value())
+        cancel(context);
+    // The context may be gone once it's settled.
+    settle(context);
+}
+
+bool EventLoop::hand_to_reader(u64 id, int fd)
+{
+    if (!m_reader_started) {
+        if (auto rc = pthread_create(&m_reader, nullptr, run_reader, this); rc != 0) {
+            m_events.get(id).value()->context->error = String::formatted("Failed to start reading files: {}", strerror(rc));
+            close(fd);
+            return false;
+        }
+        m_reader_started = true;
+    }
+    pthread_mutex_lock(&m_reader_lock);
+    m_read_requests.append({ id, fd });
+    pthread_cond_signal(&m_reader_wakeup);
+    pthread_mutex_unlock(&m_reader_lock);
+    return true;
+}
+
+void* EventLoop::run_reader(void* argument)
+{
+    auto& loop = *static_cast<EventLoop*>(argument);
+    pthread_mutex_lock(&loop.m_reader_lock);
+    for (;;) {
+        while (loop.m_read_requests.is_empty() && !loop.m_reader_stopping)
+            pthread_cond_wait(&loop.m_reader_wakeup, &loop.m_reader_lock);
+        if (loop.m_reader_stopping)
+            break;
+        auto request = loop.m_read_requests.take_first();
+        pthread_mutex_unlock(&loop.m_reader_lock);
+
+        FinishedRead finished { request.id, 0, {} };
+        char buffer[64 * KiB];
+        for (;;) {
+            auto nread = read(request.fd, buffer, sizeof(buffer));
+            if (nread < 0) {
+                if (errno == EINTR)
+                    continue;
+                finished.error = errno;
+                break;
+            }
+            if (nread == 0)
+                break;
+            finished.data.append(buffer, nread);
+        }
+        close(request.fd);
+
+        pthread_mutex_lock(&loop.m_reader_lock);
+        loop.m_finished_reads.append(move(finished));
+        u64 one = 1;
+        (void)write(loop.m_wake_fd, &one, sizeof(one));
+    }
+    for (auto& request : loop.m_read_requests)
+        close(request.fd);
+    pthread_mutex_unlock(&loop.m_reader_lock);
+    return nullptr;
+}
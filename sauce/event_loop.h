@@ -0,0 +1,116 @@
+#pragma once
+
+#include "types.h"
+#include <AK/Function.h>
+#include <AK/HashMap.h>
+#include <AK/NonnullOwnPtr.h>
+#include <AK/Result.h>
+#include <pthread.h>
+
+// Waits on the timers and file reads scripts start, and calls their callbacks on the thread running the loop, in the
+// context that started them. Any number of contexts may have callbacks pending at once, each of which has to outlive
+// them or have them cancelled. Regular files can't be waited on with epoll, so they're read on a helper thread, which
+// only ever handles bytes and never values.
+class EventLoop {
+    AK_MAKE_NONCOPYABLE(EventLoop);
+    AK_MAKE_NONMOVABLE(EventLoop);
+
+public:
+    // Fails with a message if the loop's file descriptors can't be created.
+    static Result<NonnullOwnPtr<EventLoop>, String> create();
+    ~EventLoop();
+
+    // Calls `callback` without arguments once `milliseconds` have passed.
+    bool add_timer(Context&, u64 milliseconds, Value callback);
+
+    // Calls `callback` with the contents of the file at `path`, once all of it has been read.
+    bool read_file(Context&, String const& path, Value callback);
+
+    // Calls `callback` whenever `fd` can be read from, until it's unwatched. Watches belong to no context, and keep the
+    // loop running as long as they're there.
+    bool watch(int fd, Function<void()> callback);
+    void unwatch(int fd);
+
+    // Calls `callback` once `milliseconds` have passed, unless the timeout is cancelled first. Like watches, timeouts
+    // belong to no context.
+    Optional<u64> add_timeout(u64 milliseconds, Function<void()> callback);
+    void cancel_timeout(u64 id);
+
+    size_t pending(Context const&) const;
+
+    // Drops every callback `context` has pending.
+    void cancel(Context&);
+
+    // Calls `on_settled` once `context` has no callbacks left to run, right away if it has none now.
+    void when_settled(Context&, Function<void()> on_settled);
+
+    // Waits for the next events and handles them. Returns false if there's nothing left to wait for.
+    bool run_once();
+
+private:
+    struct Event {
+        enum class Kind {
+            Timer,
+            Read,
+            ThreadedRead,
+            Watch,
+            Timeout,
+        };
+
+        Kind kind { Kind::Timer };
+        // Owned by the event, except for watches and reads handed to the reader thread.
+        int fd { -1 };
+        Context* context { nullptr };
+        Optional<Value> callback;
+        // What watches and timeouts call.
+        Function<void()> function;
+        String path;
+        Vector<char> data;
+    };
+
+    struct ReadRequest {
+        u64 id { 0 };
+        int fd { -1 };
+    };
+
+    struct FinishedRead {
+        u64 id { 0 };
+        int error { 0 };
+        Vector<char> data;
+    };
+
+    EventLoop(int epoll_fd, int wake_fd)
+        : m_epoll_fd(epoll_fd)
+        , m_wake_fd(wake_fd)
+    {
+    }
+
+    // Registers the event's file descriptor, if it has one, to be waited on for `epoll_events`.
+    Optional<u64> add(NonnullOwnPtr<Event>, u32 epoll_events);
+    void remove(u64 id);
+    void handle(u64 id);
+    void handle_finished_reads();
+    void read_available(u64 id);
+    void complete(u64 id, Vector<Value> arguments);
+    void settle(Context&);
+    bool hand_to_reader(u64 id, int fd);
+
+    static void* run_reader(void*);
+
+    int m_epoll_fd { -1 };
+    // Signalled by the reader thread whenever it's finished a read.
+    int m_wake_fd { -1 };
+    u64 m_next_id { 1 };
+    HashMap<u64, NonnullOwnPtr<Event>> m_events;
+    HashMap<Context const*, size_t> m_pending;
+    HashMap<Context const*, Function<void()>> m_on_settled;
+
+    // Shared with the reader thread, under `m_reader_lock`.
+    pthread_mutex_t m_reader_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t m_reader_wakeup = PTHREAD_COND_INITIALIZER;
+    Vector<ReadRequest> m_read_requests;
+    Vector<FinishedRead> m_finished_reads;
+    bool m_reader_stopping { false };
+    bool m_reader_started { false };
+    pthread_t m_reader;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <AK/Optional.h>
+#include <AK/Types.h>
+
+// What an execution site has seen so far. A learning site records the kind of value it sees, or nothing if what it saw
+// can't be specialized for; once it's seen the same kind `hot_threshold` times in a row it becomes specialized for it.
+// Sites that keep changing their minds, or that see anything else once specialized, stay generic for good.
+template<typename Kind>
+class TypeFeedback {
+public:
+    static constexpr u32 hot_threshold = 8;
+    static constexpr u32 max_changes = 4;
+
+    bool is_learning() const { return m_state == State::Learning; }
+    bool is_specialized() const { return m_state == State::Specialized; }
+    Kind const& kind() const { return m_kind; }
+
+    void record(Optional<Kind> const& kind)
+    {
+        if (m_state != State::Learning)
+            return;
+        if (!kind.has_value()) {
+            m_state = State::Generic;
+            return;
+        }
+        if (m_count != 0 && *kind == m_kind) {
+            if (++m_count >= hot_threshold)
+                m_state = State::Specialized;
+            return;
+        }
+        if (m_count != 0 && ++m_changes > max_changes) {
+            m_state = State::Generic;
+            return;
+        }
+        m_kind = *kind;
+        m_count = 1;
+    }
+
+    void give_up() { m_state = State::Generic; }
+
+private:
+    enum class State : u8 {
+        Learning,
+        Specialized,
+        Generic,
+    };
+
+    State m_state { State::Learning };
+    u32 m_changes { 0 };
+    u32 m_count { 0 };
+    Kind m_kind {};
+};
@@ -0,0 +1,392 @@
+#include "heap.h"
+#include "types.h"
+#include <AK/Format.h>
+#include <AK/Time.h>
+
+static thread_local Heap* s_current_heap = nullptr;
+
+StringView to_string(AllocationKind kind)
+{
+    switch (kind) {
+    case AllocationKind::Type:
+        return "types"sv;
+    case AllocationKind::Record:
+        return "records"sv;
+    case AllocationKind::ResolutionSet:
+        return "resolution sets"sv;
+    case AllocationKind::Scope:
+        return "scopes"sv;
+    case AllocationKind::String:
+        return "strings"sv;
+    case AllocationKind::Sequence:
+        return "sequences"sv;
+    case AllocationKind::__Count:
+        break;
+    }
+    VERIFY_NOT_REACHED();
+}
+
+HeapCell::HeapCell(size_t size, AllocationKind kind)
+    : m_size(size)
+    , m_kind(kind)
+{
+    if (auto heap = Heap::current())
+        heap->did_create_cell(*this);
+}
+
+void HeapCell::account(size_t bytes)
+{
+    if (!m_heap) {
+        m_size += bytes;
+        return;
+    }
+    auto& list = m_is_old ? m_heap->m_old : m_heap->m_young;
+    list.bytes += bytes;
+    m_size += bytes;
+    m_heap->charge(m_kind, bytes);
+}
+
+HeapCell::~HeapCell()
+{
+    if (m_heap)
+        m_heap->will_destroy_cell(*this);
+}
+
+void Heap::CellList::append(HeapCell& cell)
+{
+    cell.m_previous = nullptr;
+    cell.m_next = head;
+    if (head)
+        head->m_previous = &cell;
+    head = &cell;
+    bytes += cell.m_size;
+    ++count;
+}
+
+void Heap::CellList::remove(HeapCell& cell)
+{
+    if (cell.m_previous)
+        cell.m_previous->m_next = cell.m_next;
+    else
+        head = cell.m_next;
+    if (cell.m_next)
+        cell.m_next->m_previous = cell.m_previous;
+    cell.m_previous = nullptr;
+    cell.m_next = nullptr;
+    bytes -= cell.m_size;
+    --count;
+}
+
+Heap::Heap()
+{
+    set_limit(default_limit);
+}
+
+Heap::~Heap()
+{
+    // Cells may outlive their heap (e.g. values shared with a context snapshot), they're simply no longer tracked.
+    for (auto* list : { &m_young, &m_old }) {
+        for (auto* cell = list->head; cell;) {
+            auto* next = cell->m_next;
+            cell->m_heap = nullptr;
+            cell->m_previous = nullptr;
+            cell->m_next = nullptr;
+            cell = next;
+        }
+    }
+    if (s_current_heap == this)
+        s_current_heap = nullptr;
+}
+
+Heap* Heap::current()
+{
+    return s_current_heap;
+}
+
+Heap::Activation::Activation(Heap& heap)
+    : m_previous(s_current_heap)
+{
+    s_current_heap = &heap;
+}
+
+Heap::Activation::~Activation()
+{
+    s_current_heap = m_previous;
+}
+
+void Heap::set_limit(size_t limit)
+{
+    m_limit = limit;
+    m_young_limit = max(limit / 16, static_cast<size_t>(64 * KiB));
+    update_next_major_collection();
+}
+
+void Heap::set_memory_limit(size_t limit)
+{
+    m_memory_limit = limit;
+    update_next_major_collection();
+}
+
+void Heap::update_next_major_collection()
+{
+    m_next_major_collection = max(m_limit, live_bytes() * 2);
+    // Crossing the memory limit always gets a chance to collect before it's reported.
+    if (m_memory_limit != 0)
+        m_next_major_collection = min(m_next_major_collection, m_memory_limit + 1);
+}
+
+void Heap::charge(AllocationKind kind, size_t bytes)
+{
+    for (auto* usage : { &m_usage[to_underlying(kind)], &m_total_usage }) {
+        usage->current += bytes;
+        usage->peak = max(usage->peak, usage->current);
+    }
+}
+
+void Heap::credit(AllocationKind kind, size_t bytes)
+{
+    m_usage[to_underlying(kind)].current -= bytes;
+    m_total_usage.current -= bytes;
+}
+
+void Heap::did_create_cell(HeapCell& cell)
+{
+    cell.m_heap = this;
+    cell.m_is_old = false;
+    m_young.append(cell);
+    ++m_usage[to_underlying(cell.m_kind)].allocations;
+    ++m_total_usage.allocations;
+    charge(cell.m_kind, cell.m_size);
+}
+
+void Heap::will_destroy_cell(HeapCell& cell)
+{
+    (cell.m_is_old ? m_old : m_young).remove(cell);
+    credit(cell.m_kind, cell.m_size);
+    cell.m_heap = nullptr;
+}
+
+void Heap::track(String const& string)
+{
+    auto impl = string.impl();
+    if (!impl)
+        return;
+    auto bytes = sizeof(StringImpl) + impl->length();
+    m_strings.strings.append(*impl);
+    m_strings.bytes += bytes;
+    m_strings.young_bytes += bytes;
+    ++m_usage[to_underlying(AllocationKind::String)].allocations;
+    ++m_total_usage.allocations;
+    charge(AllocationKind::String, bytes);
+}
+
+void Heap::sweep_strings()
+{
+    m_strings.strings.remove_all_matching([&](auto& impl) {
+        // Only the heap still refers to this string.
+        if (impl->ref_count() != 1)
+            return false;
+        auto bytes = sizeof(StringImpl) + impl->length();
+        m_strings.bytes -= bytes;
+        credit(AllocationKind::String, bytes);
+        return true;
+    });
+    m_strings.young_bytes = 0;
+}
+
+void Heap::collect_garbage(bool major)
+{
+    auto start = Time::now_monotonic();
+
+    Vector<HeapCell*> candidates;
+    candidates.ensure_capacity(m_young.count + (major ? m_old.count : 0));
+    for (auto* cell = m_young.head; cell; cell = cell->m_next)
+        candidates.unchecked_append(cell);
+    if (major) {
+        for (auto* cell = m_old.head; cell; cell = cell->m_next)
+            candidates.unchecked_append(cell);
+    }
+
+    for (auto* cell : candidates) {
+        cell->m_state = HeapCell::State::Candidate;
+        cell->m_gc_refs = cell->gc_ref_count();
+    }
+
+    struct SubtractInternalReferences final : public HeapCell::Visitor {
+        virtual void visit(HeapCell& cell) override
+        {
+            if (cell.m_state == HeapCell::State::Candidate)
+                --cell.m_gc_refs;
+        }
+    } subtract;
+    for (auto* cell : candidates)
+        cell->visit_edges(subtract);
+
+    Vector<HeapCell*> worklist;
+    for (auto* cell : candidates) {
+        if (cell->m_gc_refs > 0) {
+            cell->m_state = HeapCell::State::Reachable;
+            worklist.append(cell);
+        }
+    }
+
+    struct MarkReachable final : public HeapCell::Visitor {
+        explicit MarkReachable(Vector<HeapCell*>& worklist)
+            : worklist(worklist)
+        {
+        }
+
+        virtual void visit(HeapCell& cell) override
+        {
+            if (cell.m_state != HeapCell::State::Candidate)
+                return;
+            cell.m_state = HeapCell::State::Reachable;
+            worklist.append(&cell);
+        }
+
+        Vector<HeapCell*>& worklist;
+    } mark { worklist };
+    while (!worklist.is_empty())
+        worklist.take_last()->visit_edges(mark);
+
+    Vector<HeapCell*> garbage;
+    for (auto* cell : candidates) {
+        if (cell->m_state == HeapCell::State::Candidate) {
+            cell->m_state = HeapCell::State::Garbage;
+            garbage.append(cell);
+        } else {
+            cell->m_state = HeapCell::State::None;
+        }
+    }
+
+    // Everything that survived a collection is promoted.
+    for (auto* cell = m_young.head; cell;) {
+        auto* next = cell->m_next;
+        if (cell->m_state != HeapCell::State::Garbage) {
+            m_young.remove(*cell);
+            cell->m_is_old = true;
+            m_old.append(*cell);
+        }
+        cell = next;
+    }
+
+    // Keep the garbage alive while the cycles are broken up, so that no cell is freed while another still points to it.
+    for (auto* cell : garbage)
+        cell->gc_ref();
+    for (auto* cell : garbage)
+        cell->clear_edges();
+    for (auto* cell : garbage) {
+        cell->m_state = HeapCell::State::None;
+        m_statistics.bytes_reclaimed += cell->m_size;
+        cell->gc_unref();
+    }
+    m_statistics.cells_reclaimed += garbage.size();
+
+    sweep_strings();
+
+    if (major) {
+        ++m_statistics.major_collections;
+        update_next_major_collection();
+    } else {
+        ++m_statistics.minor_collections;
+    }
+
+    auto pause = static_cast<u64>((Time::now_monotonic() - start).to_nanoseconds());
+    m_statistics.total_pause_ns += pause;
+    m_statistics.max_pause_ns = max(m_statistics.max_pause_ns, pause);
+}
+
+void Heap::dump_statistics() const
+{
+    warnln("Heap: {} live cells ({} bytes), limit {} bytes", live_cells(), live_bytes(), m_limit);
+    warnln("  collections: {} minor, {} major", m_statistics.minor_collections, m_statistics.major_collections);
+    warnln("  reclaimed: {} cells ({} bytes)", m_statistics.cells_reclaimed, m_statistics.bytes_reclaimed);
+    warnln("  pauses: {}us total, {}us max", m_statistics.total_pause_ns / 1000, m_statistics.max_pause_ns / 1000);
+    warnln("Memory: {} bytes current, {} bytes peak, {} allocations", m_total_usage.current, m_total_usage.peak, m_total_usage.allocations);
+    for (u8 kind = 0; kind < to_underlying(AllocationKind::__Count); ++kind) {
+        auto& usage = m_usage[kind];
+        warnln("  {}: {} bytes current, {} bytes peak, {} allocations", to_string(static_cast<AllocationKind>(kind)), usage.current, usage.peak, usage.allocations);
+    }
+}
+
+void visit_value_edges(Value const& value, HeapCell::Visitor& visitor)
+{
+    value.value.visit(
+        [&](NonnullRefPtr<Type> const& type) { visitor.visit(const_cast<Type&>(*type)); },
+        [&](FunctionValue const& function) {
+            for (auto& frame : function.scope)
+                visitor.visit(frame.shared());
+            for (auto& frame : function.comment_scope)
+                visitor.visit(frame.shared());
+        },
+        [&](NonnullRefPtr<CommentResolutionSet> const& crs) { visitor.visit(const_cast<CommentResolutionSet&>(*crs)); },
+        [&](RecordValue const& record) {
+            visitor.visit(const_cast<Type&>(*record.type));
+            visitor.visit(const_cast<RecordMembers&>(*record.members));
+        },
+        [&](NonnullRefPtr<Sequence> const& sequence) { visitor.visit(const_cast<Sequence&>(*sequence)); },
+        [](auto const&) {});
+}
+
+void visit_value_edges(Vector<Value> const& values, HeapCell::Visitor& visitor)
+{
+    for (auto& value : values)
+        visit_value_edges(value, visitor);
+}
+
+void Type::visit_edges(HeapCell::Visitor& visitor) const
+{
+    if (auto members = decl.get_pointer<Vector<TypeName>>()) {
+        for (auto& member : *members)
+            visitor.visit(const_cast<Type&>(*member.type));
+    }
+}
+
+void Type::clear_edges()
+{
+    decl = NativeType::Any;
+}
+
+void CommentResolutionSet::visit_edges(HeapCell::Visitor& visitor) const
+{
+    visit_value_edges(values, visitor);
+    if (deferred) {
+        visitor.visit(*deferred->source);
+        visit_value_edges(deferred->arguments, visitor);
+    }
+}
+
+void CommentResolutionSet::clear_edges()
+{
+    values.clear();
+    deferred = nullptr;
+}
+
+void RecordMembers::visit_edges(HeapCell::Visitor& visitor) const
+{
+    visit_value_edges(values, visitor);
+}
+
+void RecordMembers::clear_edges()
+{
+    values.clear();
+}
+
+void Sequence::visit_edges(HeapCell::Visitor& visitor) const
+{
+    source.visit(
+        [&](Generator const& generator) {
+            visit_value_edges(generator.seed, visitor);
+            visit_value_edges(generator.step, visitor);
+        },
+        [&](Value const& value) { visit_value_edges(value, visitor); },
+        [](Range const&) {});
+    for (auto& stage : stages)
+        visit_value_edges(stage.function, visitor);
+}
+
+void Sequence::clear_edges()
+{
+    source = Range {};
+    stages.clear();
+}
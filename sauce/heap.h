@@ -0,0 +1,199 @@
+#pragma once
+
+#include "Vector.h"
+#include <AK/Noncopyable.h>
+#include <AK/RefCounted.h>
+#include <AK/String.h>
+#include <AK/Types.h>
+
+class Heap;
+
+enum class AllocationKind : u8 {
+    Type,
+    Record,
+    ResolutionSet,
+    Scope,
+    String,
+    Sequence,
+    __Count,
+};
+
+StringView to_string(AllocationKind);
+
+// Something that owns references to other cells, and so may be part of a reference cycle.
+class HeapCell {
+    AK_MAKE_NONCOPYABLE(HeapCell);
+    AK_MAKE_NONMOVABLE(HeapCell);
+
+public:
+    class Visitor {
+    public:
+        virtual ~Visitor() = default;
+        virtual void visit(HeapCell&) = 0;
+    };
+
+    virtual ~HeapCell();
+
+    // Must visit every cell this one holds a reference to, exactly once per reference held.
+    virtual void visit_edges(Visitor&) const = 0;
+
+    // Charges `bytes` of storage owned by this cell to its heap, until the cell is destroyed.
+    void account(size_t bytes);
+
+protected:
+    HeapCell(size_t size, AllocationKind);
+
+private:
+    friend class Heap;
+
+    virtual unsigned gc_ref_count() const = 0;
+    virtual void gc_ref() const = 0;
+    virtual void gc_unref() const = 0;
+    // Drops every reference this cell holds, called only once the cell is known to be garbage.
+    virtual void clear_edges() = 0;
+
+    enum class State : u8 {
+        None,
+        Candidate,
+        Reachable,
+        Garbage,
+    };
+
+    Heap* m_heap { nullptr };
+    HeapCell* m_previous { nullptr };
+    HeapCell* m_next { nullptr };
+    size_t m_size { 0 };
+    i64 m_gc_refs { 0 };
+    AllocationKind m_kind;
+    State m_state { State::None };
+    bool m_is_old { false };
+};
+
+template<typename T, AllocationKind kind>
+class RefCountedCell
+    : public RefCounted<T>
+    , public HeapCell {
+protected:
+    RefCountedCell()
+        : HeapCell(sizeof(T), kind)
+    {
+    }
+
+private:
+    virtual unsigned gc_ref_count() const override { return RefCounted<T>::ref_count(); }
+    virtual void gc_ref() const override { RefCounted<T>::ref(); }
+    virtual void gc_unref() const override { RefCounted<T>::unref(); }
+};
+
+// Reclaims reference cycles between cells by trial deletion: references that candidate cells hold on each other are
+// subtracted from their reference counts, and whatever is not reachable from a cell with references left is garbage.
+// New cells are collected on their own (minor collections) until they survive one, after which they only take part in
+// major collections.
+// Every cell and every string a native produces is charged to the heap it was created in, and a heap may be given a
+// memory limit that the owning context refuses to run past.
+class Heap {
+    AK_MAKE_NONCOPYABLE(Heap);
+    AK_MAKE_NONMOVABLE(Heap);
+
+public:
+    struct Statistics {
+        size_t minor_collections { 0 };
+        size_t major_collections { 0 };
+        size_t cells_reclaimed { 0 };
+        size_t bytes_reclaimed { 0 };
+        u64 total_pause_ns { 0 };
+        u64 max_pause_ns { 0 };
+    };
+
+    struct Usage {
+        size_t current { 0 };
+        size_t peak { 0 };
+        size_t allocations { 0 };
+    };
+
+    static constexpr size_t default_limit = 64 * MiB;
+
+    Heap();
+    ~Heap();
+
+    // The heap new cells on this thread are registered with.
+    static Heap* current();
+
+    class Activation {
+        AK_MAKE_NONCOPYABLE(Activation);
+        AK_MAKE_NONMOVABLE(Activation);
+
+    public:
+        explicit Activation(Heap&);
+        ~Activation();
+
+    private:
+        Heap* m_previous { nullptr };
+    };
+
+    // The number of live bytes at which a major collection is triggered.
+    size_t limit() const { return m_limit; }
+    void set_limit(size_t);
+
+    // The number of live bytes this heap may not exceed, or zero for no limit.
+    size_t memory_limit() const { return m_memory_limit; }
+    void set_memory_limit(size_t);
+
+    size_t live_bytes() const { return m_young.bytes + m_old.bytes + m_strings.bytes; }
+    size_t live_cells() const { return m_young.count + m_old.count; }
+    Statistics const& statistics() const { return m_statistics; }
+    Usage const& usage(AllocationKind kind) const { return m_usage[to_underlying(kind)]; }
+    Usage const& total_usage() const { return m_total_usage; }
+
+    // Charges a string produced at runtime to this heap, it's credited back by the first collection after it dies.
+    void track(String const&);
+
+    // Called at points where every live cell is fully constructed; returns false if the memory limit is exceeded even
+    // after collecting.
+    bool collect_if_needed()
+    {
+        if (m_young.bytes + m_strings.young_bytes < m_young_limit && live_bytes() < m_next_major_collection) [[likely]]
+            return true;
+        collect_garbage(live_bytes() >= m_next_major_collection);
+        return m_memory_limit == 0 || live_bytes() <= m_memory_limit;
+    }
+
+    void collect_garbage(bool major = true);
+    void dump_statistics() const;
+
+private:
+    friend class HeapCell;
+
+    struct CellList {
+        HeapCell* head { nullptr };
+        size_t bytes { 0 };
+        size_t count { 0 };
+
+        void append(HeapCell&);
+        void remove(HeapCell&);
+    };
+
+    struct TrackedStrings {
+        Vector<NonnullRefPtr<StringImpl>> strings;
+        size_t bytes { 0 };
+        size_t young_bytes { 0 };
+    };
+
+    void did_create_cell(HeapCell&);
+    void will_destroy_cell(HeapCell&);
+    void charge(AllocationKind, size_t bytes);
+    void credit(AllocationKind, size_t bytes);
+    void sweep_strings();
+    void update_next_major_collection();
+
+    CellList m_young;
+    CellList m_old;
+    TrackedStrings m_strings;
+    Usage m_usage[to_underlying(AllocationKind::__Count)];
+    Usage m_total_usage;
+    size_t m_memory_limit { 0 };
+    size_t m_limit { default_limit };
+    size_t m_young_limit { 0 };
+    size_t m_next_major_collection { 0 };
+    Statistics m_statistics;
+};
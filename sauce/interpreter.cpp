@@ -0,0 +1,112 @@
+#include "interpreter.h"
+#include "builtins.h"
+#include "optimizer.h"
+
+Result<Vector<NonnullRefPtr<ASTNode>>, ParseError> parse_source(StringView source)
+{
+    auto lexer = Lexer { source };
+    auto parser = Parser { lexer };
+    return parser.parse_toplevel();
+}
+
+Result<NonnullOwnPtr<Interpreter>, String> Interpreter::create(Options options)
+{
+    Context base_context;
+    if (options.output_buffer.has_value())
+        base_context.output->set_capacity(*options.output_buffer);
+    Vector<NonnullRefPtr<ASTNode>> prelude_nodes;
+    {
+        Heap::Activation activation { *base_context.heap };
+        initialize_base(base_context);
+
+        auto nodes = parse_source(options.prelude);
+        if (nodes.is_error())
+            return String::formatted("Parse error in prelude: {} at {}:{}", nodes.error().error, nodes.error().where.line, nodes.error().where.column);
+        prelude_nodes = nodes.release_value();
+        for (auto& node : prelude_nodes)
+            node->run(base_context);
+    }
+
+    auto event_loop = EventLoop::create();
+    if (event_loop.is_error())
+        return event_loop.release_error();
+
+    auto snapshot = ContextSnapshot::create(move(base_context), move(prelude_nodes));
+    return adopt_own(*new Interpreter(move(options), move(snapshot), event_loop.release_value()));
+}
+
+Context Interpreter::fork()
+{
+    auto context = m_snapshot->fork();
+    if (m_options.heap_limit.has_value())
+        context.heap->set_limit(*m_options.heap_limit);
+    if (m_options.memory_limit.has_value())
+        context.heap->set_memory_limit(*m_options.memory_limit);
+    if (m_options.max_call_depth.has_value())
+        context.max_call_depth = *m_options.max_call_depth;
+    context.jit_enabled = m_options.jit;
+    context.inlining_enabled = m_options.inlining;
+    context.event_loop = m_event_loop.ptr();
+    if (m_options.output_buffer.has_value())
+        context.output->set_capacity(*m_options.output_buffer);
+    return context;
+}
+
+void Interpreter::start(StringView source, int output_fd, int error_fd, Function<void(int)> on_finish)
+{
+    auto nodes = parse_source(source);
+    if (nodes.is_error()) {
+        OutputBuffer errors { error_fd, 0 };
+        errors.appendff("Parse error: {} at {}:{}", nodes.error().error, nodes.error().where.line, nodes.error().where.column);
+        errors.end_line();
+        errors.flush();
+        on_finish(1);
+        return;
+    }
+
+    if (m_options.optimize) {
+        fold_constants(nodes.value(), *m_snapshot);
+        resolve_mentions_statically(nodes.value(), *m_snapshot);
+        mark_compilable_functions(nodes.value(), *m_snapshot);
+    }
+
+    m_scripts.append(adopt_own(*new Script { fork(), error_fd, move(on_finish) }));
+    auto& script = *m_scripts.last();
+    auto& context = script.context;
+    context.output = make<OutputBuffer>(output_fd, context.output->capacity());
+    {
+        Heap::Activation activation { *context.heap };
+        for (auto& node : nodes.value())
+            node->run(context);
+    }
+
+    if (context.error.has_value())
+        m_event_loop->cancel(context);
+    m_event_loop->when_settled(context, [this, &script] { finish(script); });
+}
+
+void Interpreter::finish(Script& script)
+{
+    auto& context = script.context;
+    int status = 0;
+    context.output->flush();
+    if (context.error.has_value()) {
+        OutputBuffer errors { script.error_fd, 0 };
+        errors.appendff("Runtime error: {}", *context.error);
+        errors.end_line();
+        status = 1;
+    }
+
+    auto on_finish = move(script.on_finish);
+    m_scripts.remove_first_matching([&](auto& entry) { return entry.ptr() == &script; });
+    on_finish(status);
+}
+
+int Interpreter::run(StringView source, int output_fd, int error_fd)
+{
+    Optional<int> status;
+    start(source, output_fd, error_fd, [&](int finished_status) { status = finished_status; });
+    while (!status.has_value() && m_event_loop->run_once())
+        ;
+    return status.value_or(1);
+}
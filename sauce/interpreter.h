@@ -0,0 +1,74 @@
+#pragma once
+
+#include "event_loop.h"
+#include "parser.h"
+#include <AK/Function.h>
+#include <AK/NonnullOwnPtr.h>
+#include <AK/Result.h>
+
+// A base context, with the prelude already run in it, that scripts are run in fresh forks of, and the event loop their
+// timers and file reads are waited on in. Nothing an interpreter holds is safe to share between threads, so each thread
+// running scripts needs one of its own.
+class Interpreter {
+    AK_MAKE_NONCOPYABLE(Interpreter);
+    AK_MAKE_NONMOVABLE(Interpreter);
+
+public:
+    // Scripts recurse on the native stack, so threads running them get as much of it as the main thread usually does.
+    static constexpr size_t thread_stack_size = 8 * MiB;
+
+    struct Options {
+        // The source of the prelude, if any.
+        String prelude;
+        Optional<size_t> heap_limit;
+        Optional<size_t> memory_limit;
+        Optional<size_t> output_buffer;
+        Optional<size_t> max_call_depth;
+        bool optimize { true };
+        bool jit { true };
+        bool inlining { true };
+    };
+
+    // Fails with a message if the prelude doesn't parse, or the event loop can't be set up.
+    static Result<NonnullOwnPtr<Interpreter>, String> create(Options);
+
+    Options const& options() const { return m_options; }
+    ContextSnapshot& snapshot() { return *m_snapshot; }
+    EventLoop& event_loop() { return *m_event_loop; }
+
+    // A fork of the base context, with the limits in the options applied, that may start timers and file reads.
+    Context fork();
+
+    // Parses, optimizes and runs a whole program in a fork, printing to `output_fd` and reporting errors to `error_fd`.
+    // The fork is kept until every callback the program is waiting on has run in the event loop, and `on_finish` is then
+    // called with the exit status of the script; that may be before this returns.
+    void start(StringView source, int output_fd, int error_fd, Function<void(int)> on_finish);
+
+    // Like start(), but runs the event loop until the script has finished, and returns its exit status.
+    int run(StringView source, int output_fd, int error_fd);
+
+private:
+    struct Script {
+        Context context;
+        int error_fd { -1 };
+        Function<void(int)> on_finish;
+    };
+
+    Interpreter(Options options, NonnullRefPtr<ContextSnapshot> snapshot, NonnullOwnPtr<EventLoop> event_loop)
+        : m_options(move(options))
+        , m_snapshot(move(snapshot))
+        , m_event_loop(move(event_loop))
+    {
+    }
+
+    void finish(Script&);
+
+    Options m_options;
+    NonnullRefPtr<ContextSnapshot> m_snapshot;
+    Vector<NonnullOwnPtr<Script>> m_scripts;
+    // Holds on to values of the scripts' heaps, so it has to go first.
+    NonnullOwnPtr<EventLoop> m_event_loop;
+};
+
+// Parses all of `source`.
+Result<Vector<NonnullRefPtr<ASTNode>>, ParseError> parse_source(StringView source);
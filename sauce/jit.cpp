@@ -0,0 +1,288 @@
+#include "jit.h"
+#include "ast.h"
+#include <AK/Platform.h>
+#include <AK/TypeCasts.h>
+#include <string.h>
+#include <sys/mman.h>
+
+enum class JitOperation {
+    PushParameter,
+    PushImmediate,
+    Add,
+    Sub,
+    Mul,
+    Greater,
+    Equal,
+};
+
+struct JitInstruction {
+    JitOperation operation;
+    i64 operand { 0 };
+};
+
+struct JitProgram {
+    Vector<JitInstruction> instructions;
+    bool returns_comparison { false };
+};
+
+static Optional<JitOperation> operation_for(StringView name)
+{
+    if (name == "add"sv)
+        return JitOperation::Add;
+    if (name == "sub"sv)
+        return JitOperation::Sub;
+    if (name == "mul"sv)
+        return JitOperation::Mul;
+    if (name == "gt"sv)
+        return JitOperation::Greater;
+    if (name == "eq"sv)
+        return JitOperation::Equal;
+    return {};
+}
+
+// Comparisons produce u64s rather than i64s, so they may only be the outermost operation.
+static bool lower_expression(ASTNode const& node, FunctionNode const& function, JitProgram& program, bool outermost)
+{
+    if (is<IntegerLiteral>(node)) {
+        program.instructions.append({ JitOperation::PushImmediate, static_cast<IntegerLiteral const&>(node).value() });
+        return true;
+    }
+    if (is<SyntheticNode>(node)) {
+        auto number = static_cast<SyntheticNode const&>(node).value().value.get_pointer<NumberType>();
+        if (!number || !number->has<i64>())
+            return false;
+        program.instructions.append({ JitOperation::PushImmediate, number->get<i64>() });
+        return true;
+    }
+    if (is<Variable>(node)) {
+        auto& variable = static_cast<Variable const&>(node);
+        if (variable.type())
+            return false;
+        auto& parameters = function.parameters();
+        for (size_t i = 0; i < parameters.size(); ++i) {
+            if (parameters[i]->name() == variable.name()) {
+                program.instructions.append({ JitOperation::PushParameter, static_cast<i64>(i) });
+                return true;
+            }
+        }
+        return false;
+    }
+    if (!is<Call>(node))
+        return false;
+
+    auto& call = static_cast<Call const&>(node);
+    if (!is<Variable>(*call.callee()) || static_cast<Variable const&>(*call.callee()).type())
+        return false;
+    auto operation = operation_for(static_cast<Variable const&>(*call.callee()).name());
+    if (!operation.has_value() || call.arguments().is_empty())
+        return false;
+
+    auto is_comparison = *operation == JitOperation::Greater || *operation == JitOperation::Equal;
+    if (is_comparison) {
+        if (!outermost || call.arguments().size() != 2)
+            return false;
+        program.returns_comparison = true;
+    }
+
+    // Natives fold their arguments from the left.
+    if (!lower_expression(*call.arguments().first(), function, program, false))
+        return false;
+    for (size_t i = 1; i < call.arguments().size(); ++i) {
+        if (!lower_expression(*call.arguments()[i], function, program, false))
+            return false;
+        program.instructions.append({ *operation });
+    }
+    return true;
+}
+
+static Optional<JitProgram> lower_function(FunctionNode const& function)
+{
+    auto& body = const_cast<FunctionNode&>(function).body();
+    if (!function.return_() || body.size() != 1 || !is<Statement>(*body.first()))
+        return {};
+    auto& statement = *static_cast<Statement const&>(*body.first()).node();
+    if (!is<Assignment>(statement))
+        return {};
+    auto& assignment = static_cast<Assignment const&>(statement);
+    if (assignment.variable()->name() != function.return_()->name() || assignment.variable()->type())
+        return {};
+
+    JitProgram program;
+    if (!lower_expression(*assignment.value(), function, program, true))
+        return {};
+    return program;
+}
+
+static void walk_callees(ASTNode const& node, Function<void(StringView)> const& callback)
+{
+    if (is<Call>(node) && is<Variable>(*static_cast<Call const&>(node).callee()))
+        callback(static_cast<Variable const&>(*static_cast<Call const&>(node).callee()).name());
+    const_cast<ASTNode&>(node).for_each_child([&](auto& child) { walk_callees(*child, callback); });
+}
+
+#if ARCH(X86_64)
+class JitAssembler {
+public:
+    void emit(std::initializer_list<u8> bytes)
+    {
+        for (auto byte : bytes)
+            m_code.append(byte);
+    }
+
+    void emit64(u64 value)
+    {
+        for (size_t i = 0; i < 8; ++i)
+            m_code.append(static_cast<u8>(value >> (i * 8)));
+    }
+
+    void emit32(u32 value)
+    {
+        for (size_t i = 0; i < 4; ++i)
+            m_code.append(static_cast<u8>(value >> (i * 8)));
+    }
+
+    // jo <deopt>, patched once the deopt stub's position is known.
+    void jump_to_deopt_on_overflow()
+    {
+        emit({ 0x0f, 0x80 });
+        m_deopt_jumps.append(m_code.size());
+        emit32(0);
+    }
+
+    void bind_deopt()
+    {
+        for (auto offset : m_deopt_jumps) {
+            auto relative = static_cast<u32>(static_cast<i32>(m_code.size() - (offset + 4)));
+            for (size_t i = 0; i < 4; ++i)
+                m_code[offset + i] = static_cast<u8>(relative >> (i * 8));
+        }
+    }
+
+    Vector<u8> const& code() const { return m_code; }
+
+private:
+    Vector<u8> m_code;
+    Vector<size_t> m_deopt_jumps;
+};
+
+static Vector<u8> assemble(JitProgram const& program)
+{
+    JitAssembler assembler;
+    // rdi: arguments, rsi: result. rdx keeps the entry stack pointer, so a deopt can leave from any depth.
+    assembler.emit({ 0x48, 0x89, 0xe2 }); // mov rdx, rsp
+
+    for (auto& instruction : program.instructions) {
+        switch (instruction.operation) {
+        case JitOperation::PushParameter:
+            assembler.emit({ 0x48, 0x8b, 0x87 }); // mov rax, [rdi + disp32]
+            assembler.emit32(static_cast<u32>(instruction.operand * 8));
+            assembler.emit({ 0x50 }); // push rax
+            break;
+        case JitOperation::PushImmediate:
+            assembler.emit({ 0x48, 0xb8 }); // mov rax, imm64
+            assembler.emit64(static_cast<u64>(instruction.operand));
+            assembler.emit({ 0x50 }); // push rax
+            break;
+        case JitOperation::Add:
+        case JitOperation::Sub:
+        case JitOperation::Mul:
+            assembler.emit({ 0x59, 0x58 }); // pop rcx; pop rax
+            if (instruction.operation == JitOperation::Add)
+                assembler.emit({ 0x48, 0x01, 0xc8 }); // add rax, rcx
+            else if (instruction.operation == JitOperation::Sub)
+                assembler.emit({ 0x48, 0x29, 0xc8 }); // sub rax, rcx
+            else
+                assembler.emit({ 0x48, 0x0f, 0xaf, 0xc1 }); // imul rax, rcx
+            assembler.jump_to_deopt_on_overflow();
+            assembler.emit({ 0x50 }); // push rax
+            break;
+        case JitOperation::Greater:
+        case JitOperation::Equal:
+            assembler.emit({ 0x59, 0x58 });       // pop rcx; pop rax
+            assembler.emit({ 0x48, 0x39, 0xc8 }); // cmp rax, rcx
+            if (instruction.operation == JitOperation::Greater)
+                assembler.emit({ 0x0f, 0x9f, 0xc0 }); // setg al
+            else
+                assembler.emit({ 0x0f, 0x94, 0xc0 }); // sete al
+            assembler.emit({ 0x0f, 0xb6, 0xc0 });     // movzx eax, al
+            assembler.emit({ 0x50 });                 // push rax
+            break;
+        }
+    }
+
+    assembler.emit({ 0x58 });             // pop rax
+    assembler.emit({ 0x48, 0x89, 0x06 }); // mov [rsi], rax
+    assembler.emit({ 0x31, 0xc0 });       // xor eax, eax
+    assembler.emit({ 0xc3 });             // ret
+
+    assembler.bind_deopt();
+    assembler.emit({ 0x48, 0x89, 0xd4 });             // mov rsp, rdx
+    assembler.emit({ 0xb8, 0x01, 0x00, 0x00, 0x00 }); // mov eax, 1
+    assembler.emit({ 0xc3 });                         // ret
+    return assembler.code();
+}
+#endif
+
+bool JitCode::can_compile(FunctionNode const& function, Function<bool(StringView)> const& is_builtin)
+{
+#if ARCH(X86_64)
+    if (!lower_function(function).has_value())
+        return false;
+    auto all_builtins = true;
+    for (auto& statement : const_cast<FunctionNode&>(function).body())
+        walk_callees(*statement, [&](auto name) { all_builtins = all_builtins && is_builtin(name); });
+    return all_builtins;
+#else
+    (void)function;
+    (void)is_builtin;
+    return false;
+#endif
+}
+
+OwnPtr<JitCode> JitCode::compile(FunctionNode const& function)
+{
+#if ARCH(X86_64)
+    auto program = lower_function(function);
+    if (!program.has_value())
+        return {};
+    auto code = assemble(*program);
+
+    auto memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return {};
+    memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) < 0) {
+        munmap(memory, code.size());
+        return {};
+    }
+    return adopt_own(*new JitCode(memory, code.size(), function.parameters().size(), program->returns_comparison));
+#else
+    (void)function;
+    return {};
+#endif
+}
+
+JitCode::~JitCode()
+{
+    munmap(m_code, m_size);
+}
+
+Optional<Value> JitCode::call(Vector<Value> const& arguments) const
+{
+    Vector<i64, 8> values;
+    for (size_t i = 0; i < m_parameter_count; ++i) {
+        if (i >= arguments.size())
+            return {};
+        auto number = arguments[i].value.get_pointer<NumberType>();
+        if (!number || !number->has<i64>())
+            return {};
+        values.append(number->get<i64>());
+    }
+
+    i64 result = 0;
+    if (reinterpret_cast<Entry>(m_code)(values.data(), &result) != 0)
+        return {};
+    if (m_returns_comparison)
+        return Value { NumberType(static_cast<u64>(result)) };
+    return Value { NumberType(result) };
+}
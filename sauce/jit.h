@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+#include <AK/Function.h>
+#include <AK/Noncopyable.h>
+#include <AK/OwnPtr.h>
+
+class FunctionNode;
+
+// A baseline compiler for tiny arithmetic functions like `{ |a b|: r let r = add(mul(a 2) b); }`: the body becomes a
+// stack machine, each operation a fixed x86-64 template, stitched together in executable memory.
+// Compiled code only works on i64; it hands the call back to the interpreter whenever an argument isn't one, or an
+// operation overflows.
+class JitCode {
+    AK_MAKE_NONCOPYABLE(JitCode);
+    AK_MAKE_NONMOVABLE(JitCode);
+
+public:
+    // Calls after which a compilable function gets compiled.
+    static constexpr u32 hot_call_count = 64;
+
+    // Whether the function has a shape the compiler handles; `is_builtin` tells whether a name in it refers to the
+    // builtin of that name.
+    static bool can_compile(FunctionNode const&, Function<bool(StringView)> const& is_builtin);
+    static OwnPtr<JitCode> compile(FunctionNode const&);
+
+    ~JitCode();
+
+    // Returns nothing if the interpreter has to run the call instead.
+    Optional<Value> call(Vector<Value> const& arguments) const;
+
+private:
+    using Entry = int (*)(i64 const* arguments, i64* result);
+
+    JitCode(void* code, size_t size, size_t parameter_count, bool returns_comparison)
+        : m_code(code)
+        , m_size(size)
+        , m_parameter_count(parameter_count)
+        , m_returns_comparison(returns_comparison)
+    {
+    }
+
+    void* m_code { nullptr };
+    size_t m_size { 0 };
+    size_t m_parameter_count { 0 };
+    bool m_returns_comparison { false };
+};
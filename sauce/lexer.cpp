@@ -2,10 +2,25 @@
 #include <AK/CharacterTypes.h>
 #include <AK/FileStream.h>
 
-Result<Token, LexError> Lexer::next()
+Optional<char> Lexer::read()
 {
-    InputFileStream stream { stdin };
+    if (!m_input) {
+        if (m_source_offset == m_source.length())
+            return {};
+        return m_source[m_source_offset++];
+    }
 
+    InputFileStream stream { m_input };
+    char ch;
+    if (!stream.read_or_error({ &ch, 1 })) {
+        stream.handle_any_error();
+        return {};
+    }
+    return ch;
+}
+
+Result<Token, LexError> Lexer::next()
+{
     Token token = { .type = Token::Type::Unknown };
     m_start_source_position = m_current_source_position;
     char ch;
@@ -13,8 +28,9 @@ Result<Token, LexError> Lexer::next()
         bool eof = false;
         if (m_next_input.has_value()) {
             ch = m_next_input.release_value();
-        } else if (!stream.read_or_error({ &ch, 1 })) {
-            stream.handle_any_error();
+        } else if (auto next = read(); next.has_value()) {
+            ch = *next;
+        } else {
             if (m_state == Free)
                 return emit_token(Token::Type::Eof, ""sv);
             eof = true;
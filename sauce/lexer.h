@@ -3,6 +3,7 @@
 #include <AK/Result.h>
 #include <AK/String.h>
 #include <AK/StringView.h>
+#include <stdio.h>
 
 struct Token {
     struct Position {
@@ -49,12 +50,29 @@ struct LexError {
 
 class Lexer {
 public:
+    // Lexes `source`, which must outlive the lexer.
+    explicit Lexer(StringView source)
+        : m_source(source)
+    {
+    }
+
+    // Lexes what can be read from `input`, only as far as tokens are asked for; for interactive input.
+    explicit Lexer(FILE* input)
+        : m_input(input)
+    {
+    }
+
     Result<Token, LexError> next();
     Token::Position current_source_position() const { return m_current_source_position; }
 
     Token emit_token(Token::Type, String);
 
 private:
+    Optional<char> read();
+
+    FILE* m_input { nullptr };
+    StringView m_source;
+    size_t m_source_offset { 0 };
     Token::Position m_current_source_position;
     Token::Position m_start_source_position;
     Optional<char> m_next_input;
@@ -0,0 +1,51 @@
+#include "mapped_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RefPtr<MappedFile> MappedFile::map(String const& path)
+{
+    auto fd = open(path.characters(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat stat_buffer;
+    if (fstat(fd, &stat_buffer) < 0) {
+        auto saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return nullptr;
+    }
+
+    // Empty files can't be mapped, but there's nothing to view in them anyway.
+    size_t size = stat_buffer.st_size;
+    void* data = nullptr;
+    if (size != 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            auto saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return nullptr;
+        }
+        // Scripts mostly go through large inputs front to back, so have the kernel read ahead.
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    return adopt_ref(*new MappedFile(data, size));
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(m_data, m_size);
+}
+
+MappedString MappedString::substring(size_t start, size_t count) const
+{
+    start = min(start, length);
+    return { file, offset + start, min(count, length - start) };
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <AK/NonnullRefPtr.h>
+#include <AK/RefCounted.h>
+#include <AK/RefPtr.h>
+#include <AK/String.h>
+#include <AK/StringView.h>
+
+// A file mapped read-only into memory, and unmapped once nothing views it anymore. Pages are only read in as they're
+// touched, so mapping even a very large file costs nothing up front, and none of it counts towards the heap.
+class MappedFile : public RefCounted<MappedFile> {
+public:
+    // Returns null, with errno set, if the file can't be opened or mapped.
+    static RefPtr<MappedFile> map(String const& path);
+
+    ~MappedFile();
+
+    StringView bytes() const { return { static_cast<char const*>(m_data), m_size }; }
+
+private:
+    MappedFile(void* data, size_t size)
+        : m_data(data)
+        , m_size(size)
+    {
+    }
+
+    void* m_data { nullptr };
+    size_t m_size { 0 };
+};
+
+// A string whose characters are part of a mapped file, rather than its own copy of them.
+struct MappedString {
+    NonnullRefPtr<MappedFile> file;
+    size_t offset { 0 };
+    size_t length { 0 };
+
+    StringView view() const { return file->bytes().substring_view(offset, length); }
+    bool is_empty() const { return length == 0; }
+
+    // Unlike String::substring, clamps the range to this string.
+    MappedString substring(size_t start, size_t count) const;
+};
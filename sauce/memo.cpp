@@ -0,0 +1,527 @@
+#include "memo.h"
+#include "builtins.h"
+#include <AK/AllOf.h>
+#include <AK/BitCast.h>
+#include <AK/TypeCasts.h>
+
+static bool has_structure(Value const& value)
+{
+    return value.value.visit(
+        [](Empty) { return true; },
+        [](NumberType const&) { return true; },
+        [](String const&) { return true; },
+        [](NonnullRefPtr<Type> const&) { return true; },
+        [](RecordValue const& record) { return all_of(record.members->values, has_structure); },
+        [](auto const&) { return false; });
+}
+
+// Record types are compared by their member names and native member types, not by the types they nest.
+static unsigned type_hash(Type const& type)
+{
+    if (auto native = type.decl.get_pointer<NativeType>())
+        return int_hash(to_underlying(*native));
+    unsigned hash = 0;
+    for (auto& member : type.decl.get<Vector<TypeName>>())
+        hash = pair_int_hash(hash, member.name.hash());
+    return hash;
+}
+
+static bool types_equal(Type const& a, Type const& b, bool nested = false)
+{
+    if (&a == &b)
+        return true;
+    if (auto native = a.decl.get_pointer<NativeType>()) {
+        auto other = b.decl.get_pointer<NativeType>();
+        return other && *native == *other;
+    }
+    auto other_members = b.decl.get_pointer<Vector<TypeName>>();
+    if (nested || !other_members)
+        return false;
+    auto& members = a.decl.get<Vector<TypeName>>();
+    if (members.size() != other_members->size())
+        return false;
+    for (size_t i = 0; i < members.size(); ++i) {
+        auto& other = other_members->at(i);
+        if (members[i].name != other.name || !types_equal(*members[i].type, *other.type, true))
+            return false;
+    }
+    return true;
+}
+
+static unsigned structural_hash(Value const& value)
+{
+    return value.value.visit(
+        [](NumberType const& number) {
+            return number.visit(
+                [](double x) { return pair_int_hash(1, u64_hash(bit_cast<u64>(x))); },
+                [](i64 x) { return pair_int_hash(2, u64_hash(static_cast<u64>(x))); },
+                [](u64 x) { return pair_int_hash(3, u64_hash(x)); });
+        },
+        [](String const& string) { return string.hash(); },
+        [](NonnullRefPtr<Type> const& type) { return type_hash(*type); },
+        [](RecordValue const& record) {
+            auto hash = type_hash(*record.type);
+            for (auto& member : record.members->values)
+                hash = pair_int_hash(hash, structural_hash(member));
+            return hash;
+        },
+        [](auto const&) { return 0u; });
+}
+
+static bool structurally_equal(Value const& a, Value const& b)
+{
+    return a.value.visit(
+        [&](Empty) { return b.value.has<Empty>(); },
+        [&](NumberType const& number) {
+            auto other = b.value.get_pointer<NumberType>();
+            // Doubles are compared by their bits, like they're hashed, so that NaN finds itself and -0 isn't 0.
+            return other && number.visit(
+                       [&](double x) { return other->has<double>() && bit_cast<u64>(other->get<double>()) == bit_cast<u64>(x); },
+                       [&]<typename T>(T x) { return other->has<T>() && other->get<T>() == x; });
+        },
+        [&](String const& string) {
+            auto other = b.value.get_pointer<String>();
+            return other && string == *other;
+        },
+        [&](NonnullRefPtr<Type> const& type) {
+            auto other = b.value.get_pointer<NonnullRefPtr<Type>>();
+            return other && types_equal(*type, **other);
+        },
+        [&](RecordValue const& record) {
+            auto other = b.value.get_pointer<RecordValue>();
+            if (!other || !types_equal(*record.type, *other->type))
+                return false;
+            auto& members = record.members->values;
+            auto& other_members = other->members->values;
+            if (members.size() != other_members.size())
+                return false;
+            for (size_t i = 0; i < members.size(); ++i) {
+                if (!structurally_equal(members[i], other_members[i]))
+                    return false;
+            }
+            return true;
+        },
+        [](auto const&) { return false; });
+}
+
+// A copy of `value` whose hash can't change: `append()` adds members to record types in place, which would otherwise
+// strand entries in the index under their old hash. Nested types are compared by identity, so only the outer ones of
+// each record need copying.
+static Value snapshot(Value const& value)
+{
+    return value.value.visit(
+        [](NonnullRefPtr<Type> const& type) -> Value { return { make_ref_counted<Type>(type->decl) }; },
+        [](RecordValue const& record) -> Value {
+            Vector<Value> members;
+            members.ensure_capacity(record.members->values.size());
+            for (auto& member : record.members->values)
+                members.append(snapshot(member));
+            return { RecordValue::create(make_ref_counted<Type>(record.type->decl), move(members)) };
+        },
+        [&](auto const&) { return value; });
+}
+
+unsigned MemoizedCall::ArgumentsTraits::hash(Vector<Value> const& arguments)
+{
+    unsigned hash = 0;
+    for (auto& argument : arguments)
+        hash = pair_int_hash(hash, structural_hash(argument));
+    return hash;
+}
+
+bool MemoizedCall::ArgumentsTraits::equals(Vector<Value> const& a, Vector<Value> const& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (!structurally_equal(a[i], b[i]))
+            return false;
+    }
+    return true;
+}
+
+FunctionValue MemoizedCall::wrap(FunctionValue function, size_t capacity)
+{
+    // Not a valid identifier, so it can't collide with a parameter.
+    String result_name = "<memo result>";
+
+    Vector<String> parameter_names;
+    for (auto& parameter : function.node->parameters())
+        parameter_names.append(parameter->name());
+
+    auto parameters = function.node->parameters();
+    auto name = String::formatted("memo({})", function.node->name());
+    auto body = adopt_ref(*new MemoizedCall(move(function), capacity, move(parameter_names), result_name));
+    auto node = make_ref_counted<FunctionNode>(
+        move(parameters),
+        make_ref_counted<Variable>(move(result_name), nullptr),
+        Vector { static_ptr_cast<ASTNode>(move(body)) });
+    node->set_name(move(name));
+    return { move(node), {}, {} };
+}
+
+void MemoizedCall::dump(int indent)
+{
+    ASTNode::dump(indent);
+    warnln("{: >{}}(Memoized, {} of {} results held)", "", indent + 1, m_entries.size(), m_capacity);
+    m_function.node->dump(indent + 2);
+}
+
+Value MemoizedCall::execute(Context& context)
+{
+    Vector<Value> arguments;
+    for (auto& name : m_parameters)
+        arguments.append(context.scope.last().get(name).value());
+
+    auto result = call(context, arguments);
+    context.scope.last().set(m_result_name, result);
+    return result;
+}
+
+Value MemoizedCall::call(Context& context, Vector<Value> const& arguments)
+{
+    auto call_through = [&] {
+        Vector<NonnullRefPtr<ASTNode>> argument_nodes;
+        for (auto& argument : arguments)
+            argument_nodes.append(make_ref_counted<SyntheticNode>(argument));
+        return make_ref_counted<Call>(static_ptr_cast<ASTNode>(make_ref_counted<SyntheticNode>(m_function)), move(argument_nodes))->run(context);
+    };
+
+    if (!all_of(arguments, has_structure))
+        return call_through();
+
+    if (auto it = m_indices.find(arguments); it != m_indices.end()) {
+        ++context.statistics.memo_hits;
+        auto index = it->value;
+        unlink(index);
+        link_as_newest(index);
+        return m_entries[index].result;
+    }
+
+    ++context.statistics.memo_misses;
+    auto result = call_through();
+    // An abandoned call has no meaningful result, and a recursive call may have already filled this entry in.
+    if (context.error.has_value() || m_indices.contains(arguments))
+        return result;
+
+    Vector<Value> key;
+    key.ensure_capacity(arguments.size());
+    for (auto& argument : arguments)
+        key.append(snapshot(argument));
+
+    size_t index;
+    if (m_entries.size() < m_capacity) {
+        index = m_entries.size();
+        m_entries.append({ key, result });
+    } else {
+        ++context.statistics.memo_evictions;
+        index = m_oldest;
+        unlink(index);
+        m_indices.remove(m_entries[index].arguments);
+        m_entries[index].arguments = key;
+        m_entries[index].result = result;
+    }
+    m_indices.set(move(key), index);
+    link_as_newest(index);
+    return result;
+}
+
+void MemoizedCall::unlink(size_t index)
+{
+    auto& entry = m_entries[index];
+    if (entry.newer != no_entry)
+        m_entries[entry.newer].older = entry.older;
+    else
+        m_newest = entry.older;
+    if (entry.older != no_entry)
+        m_entries[entry.older].newer = entry.newer;
+    else
+        m_oldest = entry.newer;
+    entry.newer = no_entry;
+    entry.older = no_entry;
+}
+
+void MemoizedCall::link_as_newest(size_t index)
+{
+    auto& entry = m_entries[index];
+    entry.newer = no_entry;
+    entry.older = m_newest;
+    if (m_newest != no_entry)
+        m_entries[m_newest].newer = index;
+    else
+        m_oldest = index;
+    m_newest = index;
+}
+
+// The arguments of natives that are called, or gone through as sequences, as one bit each.
+static u8 called_arguments(Builtin const& builtin)
+{
+    if (builtin.name == "loop"sv)
+        return 0b110;
+    if (builtin.name == "fold"sv)
+        return 0b101;
+    if (builtin.name == "each"sv)
+        return 0b011;
+    return 0;
+}
+
+static bool matches(StringView text, Vector<String> const& keywords)
+{
+    for (auto& keyword : keywords) {
+        if (!text.contains(keyword))
+            return false;
+    }
+    return true;
+}
+
+// Literals whose values can be told without running anything. Functions are checked where they're written.
+static bool is_known_literal(ASTNode& node)
+{
+    return is<FunctionNode>(node) || is<RecordDecl>(node) || is<IntegerLiteral>(node) || is<StringLiteral>(node);
+}
+
+// Checks functions by what their bodies call. Whatever can't be told before the function runs is taken to have side
+// effects: calls of parameters, of names bound to anything but literals, and of anything but a name; mentions that may
+// match comments on such values; and indirect mentions.
+class PurityCheck {
+public:
+    bool is_pure(FunctionValue const& function)
+    {
+        // Closures of the same function may hold different values, so they're told apart by their innermost frames.
+        auto* frame = function.scope.is_empty() ? nullptr : &function.scope.last().shared();
+        auto& seen_frames = m_seen.ensure(function.node.ptr());
+        if (seen_frames.contains_slow(frame))
+            return true;
+        seen_frames.append(frame);
+
+        Body body { function };
+        collect_bindings(*function.node, body);
+        for (auto& frame : function.comment_scope) {
+            frame.for_each([&](Comment* comment, auto& values) {
+                if (!all_of(values, [&](auto& value) { return is_pure_value(value); }))
+                    body.unknown_comments.append(comment->text());
+            });
+        }
+
+        auto pure = true;
+        function.node->for_each_child([&](auto& child) { pure = pure && check(*child, body); });
+        return pure;
+    }
+
+    // Whether calling `value` with any arguments can't have side effects.
+    bool is_pure_callee(Value const& value)
+    {
+        return value.value.visit(
+            [](NativeFunctionType const& native) {
+                auto builtin = find_builtin(native.fn);
+                return builtin && !builtin->has_side_effects && !called_arguments(*builtin);
+            },
+            [&](FunctionValue const& function) { return is_pure(function); },
+            [](NonnullRefPtr<Type> const&) { return true; },
+            [&](NonnullRefPtr<CommentResolutionSet> const& set) {
+                return !set->deferred && all_of(set->values, [&](auto& element) { return is_pure_callee(element); });
+            },
+            [](auto const&) { return false; });
+    }
+
+    // Whether nothing `value` holds can have side effects if it's called.
+    bool is_pure_value(Value const& value)
+    {
+        return value.value.visit(
+            [&](NativeFunctionType const&) { return is_pure_callee(value); },
+            [&](FunctionValue const&) { return is_pure_callee(value); },
+            [&](NonnullRefPtr<CommentResolutionSet> const& set) {
+                return !set->deferred && all_of(set->values, [&](auto& element) { return is_pure_value(element); });
+            },
+            [&](RecordValue const& record) { return all_of(record.members->values, [&](auto& member) { return is_pure_value(member); }); },
+            [&](NonnullRefPtr<Sequence> const& sequence) {
+                auto source_is_pure = sequence->source.visit(
+                    [&](Sequence::Generator const& generator) { return is_pure_value(generator.seed) && is_pure_callee(generator.step); },
+                    [&](Value const& source) { return is_pure_value(source); },
+                    [](Sequence::Range const&) { return true; });
+                return source_is_pure && all_of(sequence->stages, [&](auto& stage) { return stage.kind == Sequence::StageKind::Take || is_pure_callee(stage.function); });
+            },
+            [](auto const&) { return true; });
+    }
+
+private:
+    struct Body {
+        FunctionValue const& function;
+        // Names bound anywhere in the function, nested functions included, and whether they're only ever bound to
+        // literals. Parameters never are.
+        HashMap<String, bool> locals {};
+        // Comments that may be on values that aren't known ahead of time.
+        Vector<String> unknown_comments {};
+    };
+
+    static void collect_bindings(ASTNode& node, Body& body)
+    {
+        auto bind = [&](String const& name, bool known) {
+            auto& all_known = body.locals.ensure(name, [] { return true; });
+            all_known = all_known && known;
+        };
+
+        if (is<FunctionNode>(node)) {
+            auto& function = static_cast<FunctionNode&>(node);
+            for (auto& parameter : function.parameters())
+                bind(parameter->name(), false);
+            if (function.return_())
+                bind(function.return_()->name(), true);
+
+            // Comments are on the value of the next statement that isn't a comment.
+            Vector<String> pending_comments;
+            for (auto& expression : function.body()) {
+                ASTNode* statement = expression.ptr();
+                if (is<Statement>(*statement) && static_cast<Statement&>(*statement).node())
+                    statement = static_cast<Statement&>(*statement).node().ptr();
+                if (is<Comment>(*statement)) {
+                    pending_comments.append(static_cast<Comment&>(*statement).text());
+                    continue;
+                }
+                auto value = statement;
+                if (is<Assignment>(*statement))
+                    value = static_cast<Assignment&>(*statement).value().ptr();
+                if (!is_known_literal(*value))
+                    body.unknown_comments.extend(move(pending_comments));
+                pending_comments.clear();
+            }
+        } else if (is<Assignment>(node)) {
+            auto& assignment = static_cast<Assignment&>(node);
+            bind(assignment.variable()->name(), is_known_literal(*assignment.value()));
+        }
+        node.for_each_child([&](auto& child) { collect_bindings(*child, body); });
+    }
+
+    // The value `name` has wherever the function refers to it, if that can be told without knowing its local bindings.
+    static Optional<Value> resolve(String const& name, Body const& body)
+    {
+        if (body.locals.contains(name))
+            return {};
+        auto& scope = body.function.scope;
+        for (size_t i = scope.size(); i > 0; --i) {
+            if (auto value = scope[i - 1].find(name))
+                return *value;
+        }
+        if (auto builtin = find_builtin(name))
+            return builtin->value();
+        return {};
+    }
+
+    static bool is_bound_to_literals(String const& name, Body const& body)
+    {
+        auto it = body.locals.find(name);
+        return it != body.locals.end() && it->value;
+    }
+
+    // Whether the value of `node` is known ahead of time and can't have side effects if it's called.
+    bool is_known_and_pure(ASTNode& node, Body const& body)
+    {
+        if (is<IntegerLiteral>(node) || is<StringLiteral>(node))
+            return true;
+        if (is<FunctionNode>(node) || is<DirectMention>(node))
+            return check(node, body);
+        if (is<SyntheticNode>(node))
+            return is_pure_value(static_cast<SyntheticNode&>(node).value());
+        if (is<Variable>(node)) {
+            auto& name = static_cast<Variable&>(node).name();
+            if (is_bound_to_literals(name, body))
+                return true;
+            auto value = resolve(name, body);
+            return value.has_value() && is_pure_value(*value);
+        }
+        // Pure functions called on known values can only return those values or ones they hold themselves.
+        if (is<Call>(node)) {
+            auto& call = static_cast<Call&>(node);
+            return check(call, body) && all_of(call.arguments(), [&](auto& argument) { return is_known_and_pure(*argument, body); });
+        }
+        return false;
+    }
+
+    bool check_callee(ASTNode& callee, Body const& body, Call& call)
+    {
+        Optional<Value> value;
+        if (is<Variable>(callee)) {
+            auto& name = static_cast<Variable&>(callee).name();
+            // Bound functions are checked where they're written, and records are only ever built.
+            if (is_bound_to_literals(name, body))
+                return all_of(call.arguments(), [&](auto& argument) { return check(*argument, body); });
+            value = resolve(name, body);
+        } else if (is<SyntheticNode>(callee)) {
+            value = static_cast<SyntheticNode&>(callee).value();
+        } else if (is<FunctionNode>(callee)) {
+            return check(callee, body);
+        }
+        if (!value.has_value())
+            return false;
+
+        // Natives that call their arguments are only as pure as those are.
+        if (auto native = value->value.get_pointer<NativeFunctionType>()) {
+            auto builtin = find_builtin(native->fn);
+            if (builtin && !builtin->has_side_effects && called_arguments(*builtin)) {
+                auto& arguments = call.arguments();
+                for (size_t i = 0; i < arguments.size() && i < 8; ++i) {
+                    if ((called_arguments(*builtin) & (1 << i)) && !is_known_and_pure(*arguments[i], body))
+                        return false;
+                }
+                return true;
+            }
+        }
+        return is_pure_callee(*value);
+    }
+
+    bool check(ASTNode& node, Body const& body)
+    {
+        if (is<IndirectMention>(node))
+            return false;
+
+        if (is<DirectMention>(node)) {
+            auto& keywords = static_cast<DirectMention&>(node).keywords();
+            // Natives bound to names are builtins too, so only builtins' words need to be checked.
+            for (auto& builtin : builtins()) {
+                if (builtin.has_side_effects && matches_all(builtin.comment.span(), keywords))
+                    return false;
+            }
+            for (auto& comment : body.unknown_comments) {
+                if (matches(comment, keywords))
+                    return false;
+            }
+            return true;
+        }
+
+        if (is<MemoizedCall>(node))
+            return is_pure(static_cast<MemoizedCall&>(node).function());
+
+        if (is<SyntheticNode>(node))
+            return is_pure_value(static_cast<SyntheticNode&>(node).value());
+
+        if (is<Call>(node)) {
+            auto& call = static_cast<Call&>(node);
+            if (!check_callee(*call.callee(), body, call))
+                return false;
+            return all_of(call.arguments(), [&](auto& argument) { return check(*argument, body); });
+        }
+
+        if (is<Variable>(node)) {
+            // Values that are only passed around may still end up called, by natives or by the caller.
+            auto value = resolve(static_cast<Variable&>(node).name(), body);
+            if (value.has_value() && !is_pure_value(*value))
+                return false;
+        }
+
+        auto pure = true;
+        node.for_each_child([&](auto& child) { pure = pure && check(*child, body); });
+        return pure;
+    }
+
+    HashMap<FunctionNode const*, Vector<void const*>> m_seen;
+};
+
+bool may_memoize(FunctionValue const& function)
+{
+    return PurityCheck {}.is_pure(function);
+}
+
+bool is_pure_callee(Value const& value)
+{
+    return PurityCheck {}.is_pure_callee(value);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ast.h"
+#include <AK/HashMap.h>
+
+// The body of a function returned by `memo()`: looks a call's arguments up by their structure, and only calls the
+// memoized function on a miss. Once `capacity` results are held, the least recently used one is evicted.
+// Calls with arguments that have no structure to compare (functions and resolution sets) are passed straight on.
+class MemoizedCall final : public ASTNode {
+public:
+    static constexpr size_t default_capacity = 4096;
+
+    // Wraps `function` in a function that takes the same parameters.
+    static FunctionValue wrap(FunctionValue function, size_t capacity);
+
+    FunctionValue const& function() const { return m_function; }
+
+private:
+    struct ArgumentsTraits : public GenericTraits<Vector<Value>> {
+        static unsigned hash(Vector<Value> const&);
+        static bool equals(Vector<Value> const&, Vector<Value> const&);
+    };
+
+    static constexpr size_t no_entry = NumericLimits<size_t>::max();
+
+    // Entries form a list from the most to the least recently used one.
+    struct Entry {
+        Vector<Value> arguments;
+        Value result { Empty {} };
+        size_t newer { no_entry };
+        size_t older { no_entry };
+    };
+
+    MemoizedCall(FunctionValue function, size_t capacity, Vector<String> parameters, String result_name)
+        : m_function(move(function))
+        , m_capacity(capacity)
+        , m_parameters(move(parameters))
+        , m_result_name(move(result_name))
+    {
+    }
+
+    virtual Value execute(Context&) override;
+    virtual void dump(int indent) override;
+
+    Value call(Context&, Vector<Value> const& arguments);
+    void unlink(size_t index);
+    void link_as_newest(size_t index);
+
+    FunctionValue m_function;
+    size_t m_capacity { default_capacity };
+    Vector<String> m_parameters;
+    String m_result_name;
+
+    HashMap<Vector<Value>, size_t, ArgumentsTraits> m_indices;
+    Vector<Entry> m_entries;
+    size_t m_newest { no_entry };
+    size_t m_oldest { no_entry };
+};
+
+// Whether nothing `function` calls, directly or through the functions it closes over, prints or changes its arguments
+// in place. Calls that can't be resolved without running the function, like those of its parameters or of indirect
+// mentions, are taken to do either. Assignments can't escape a function's own frame, so those are always fine.
+bool may_memoize(FunctionValue const& function);
+
+// Whether calling `value` can't print or change anything in place: natives without side effects, types, functions
+// `may_memoize` accepts, and sets of only those.
+bool is_pure_callee(Value const& value);
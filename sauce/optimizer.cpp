@@ -0,0 +1,265 @@
+#include "optimizer.h"
+#include "builtins.h"
+#include "jit.h"
+#include <AK/HashTable.h>
+#include <AK/TypeCasts.h>
+
+static void collect_bound_names(ASTNode& node, HashTable<String>& names)
+{
+    if (is<Assignment>(node)) {
+        names.set(static_cast<Assignment&>(node).variable()->name());
+    } else if (is<FunctionNode>(node)) {
+        auto& function = static_cast<FunctionNode&>(node);
+        for (auto& parameter : function.parameters())
+            names.set(parameter->name());
+        if (function.return_())
+            names.set(function.return_()->name());
+    }
+    node.for_each_child([&](auto& child) { collect_bound_names(*child, names); });
+}
+
+static Optional<Value> constant_value(ASTNode const& node)
+{
+    if (is<IntegerLiteral>(node))
+        return Value { static_cast<IntegerLiteral const&>(node).value() };
+    if (is<StringLiteral>(node))
+        return Value { static_cast<StringLiteral const&>(node).value() };
+    if (is<SyntheticNode>(node))
+        return static_cast<SyntheticNode const&>(node).value();
+    return {};
+}
+
+class ConstantFolder {
+public:
+    ConstantFolder(ContextSnapshot& base, HashTable<String> bound_names)
+        : m_context(base.fork())
+        , m_bound_names(move(bound_names))
+    {
+        for (auto& frame : m_context.scope) {
+            frame.for_each([&](String const& name, Value const& value) {
+                m_base_names.set(name);
+                auto type = value.value.get_pointer<NonnullRefPtr<Type>>();
+                if (type && (*type)->decl.has<NativeType>())
+                    m_native_types.set(name);
+            });
+        }
+    }
+
+    void fold(NonnullRefPtr<ASTNode>& node)
+    {
+        node->for_each_child([&](auto& child) { fold(child); });
+        if (!is_foldable(*node))
+            return;
+
+        Heap::Activation activation { *m_context.heap };
+        auto value = node->run(m_context);
+        if (m_context.error.has_value()) {
+            m_context.error.clear();
+            return;
+        }
+        if (!value.value.has<NumberType>() && !value.value.has<String>())
+            return;
+
+        auto constant = make_ref_counted<SyntheticNode>(move(value));
+        constant->set_position(node->position());
+        node = move(constant);
+    }
+
+private:
+    bool is_foldable(ASTNode const& node) const
+    {
+        if (is<MemberAccess>(node)) {
+            auto& access = static_cast<MemberAccess const&>(node);
+            return constant_value(*access.base()).has_value() && access.property().is_one_of("length"sv, "negated"sv, "neg"sv);
+        }
+
+        if (!is<Call>(node))
+            return false;
+        auto& call = static_cast<Call const&>(node);
+        if (!is<Variable>(*call.callee()))
+            return false;
+        auto& callee = static_cast<Variable const&>(*call.callee());
+        if (callee.type() || m_bound_names.contains(callee.name()))
+            return false;
+
+        Vector<Value> arguments;
+        for (auto& argument : call.arguments()) {
+            auto value = constant_value(*argument);
+            if (!value.has_value())
+                return false;
+            arguments.append(value.release_value());
+        }
+
+        if (m_native_types.contains(callee.name()))
+            return true;
+
+        auto builtin = find_builtin(callee.name());
+        if (!builtin || !builtin->pure || m_base_names.contains(callee.name()))
+            return false;
+
+        // Leave division by zero to fail at runtime, where it would have.
+        if (builtin->name.is_one_of("div"sv, "mod"sv)) {
+            for (size_t i = 1; i < arguments.size(); ++i) {
+                auto number = arguments[i].value.get_pointer<NumberType>();
+                if (number && number->visit([](auto x) { return x == 0; }))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    Context m_context;
+    HashTable<String> m_bound_names;
+    HashTable<String> m_base_names;
+    HashTable<String> m_native_types;
+};
+
+void fold_constants(Vector<NonnullRefPtr<ASTNode>>& program, ContextSnapshot& base)
+{
+    HashTable<String> bound_names;
+    for (auto& node : program)
+        collect_bound_names(*node, bound_names);
+
+    ConstantFolder folder { base, move(bound_names) };
+    for (auto& node : program)
+        folder.fold(node);
+}
+
+struct CommentSite {
+    Comment* comment { nullptr };
+    size_t block { 0 };
+    // The statement the comment is bound to the value of, if any.
+    Optional<size_t> bound_at;
+};
+
+struct MentionSite {
+    DirectMention* mention { nullptr };
+    size_t block { 0 };
+    size_t statement { 0 };
+};
+
+class MentionResolver {
+public:
+    void visit_block(Vector<NonnullRefPtr<ASTNode>>& statements)
+    {
+        auto block = m_block_count++;
+        for (size_t i = 0; i < statements.size(); ++i) {
+            if (auto comment = comment_in(*statements[i])) {
+                CommentSite site { comment, block, {} };
+                for (size_t j = i + 1; j < statements.size(); ++j) {
+                    if (!comment_in(*statements[j])) {
+                        site.bound_at = j;
+                        break;
+                    }
+                }
+                m_comments.append(site);
+                continue;
+            }
+            visit(*statements[i], block, i);
+        }
+    }
+
+    void resolve(ContextSnapshot& base)
+    {
+        Vector<String> base_comments;
+        auto context = base.fork();
+        for (auto& frame : context.comment_scope)
+            frame.for_each([&](Comment* comment, auto&) { base_comments.append(comment->text()); });
+
+        for (auto& site : m_mentions)
+            resolve(site, base_comments);
+    }
+
+private:
+    static Comment* comment_in(ASTNode& node)
+    {
+        auto* inner = is<Statement>(node) ? static_cast<Statement&>(node).node().ptr() : &node;
+        if (!inner || !is<Comment>(*inner))
+            return nullptr;
+        return static_cast<Comment*>(inner);
+    }
+
+    static bool matches(StringView text, Vector<String> const& keywords)
+    {
+        for (auto& keyword : keywords) {
+            if (!text.contains(keyword))
+                return false;
+        }
+        return true;
+    }
+
+    void visit(ASTNode& node, size_t block, size_t statement)
+    {
+        if (is<FunctionNode>(node)) {
+            visit_block(static_cast<FunctionNode&>(node).body());
+            return;
+        }
+        if (is<DirectMention>(node))
+            m_mentions.append({ static_cast<DirectMention*>(&node), block, statement });
+        node.for_each_child([&](auto& child) { visit(*child, block, statement); });
+    }
+
+    void resolve(MentionSite const& site, Vector<String> const& base_comments)
+    {
+        auto& keywords = site.mention->keywords();
+        if (keywords.is_empty())
+            return;
+
+        // Natives can only be bound to names by evaluating a builtin, so ruling out the builtins rules out natives too.
+        for (auto& builtin : builtins()) {
+            if (matches_all(builtin.comment.span(), keywords))
+                return;
+        }
+        for (auto& text : base_comments) {
+            if (matches(text, keywords))
+                return;
+        }
+
+        Vector<Comment*> comments;
+        for (auto& comment : m_comments) {
+            if (!matches(comment.comment->text(), keywords))
+                continue;
+            if (comment.block != site.block || !comment.bound_at.has_value() || *comment.bound_at >= site.statement)
+                return;
+            comments.append(comment.comment);
+        }
+        site.mention->resolve_statically(move(comments));
+    }
+
+    size_t m_block_count { 0 };
+    Vector<CommentSite> m_comments;
+    Vector<MentionSite> m_mentions;
+};
+
+void resolve_mentions_statically(Vector<NonnullRefPtr<ASTNode>>& program, ContextSnapshot& base)
+{
+    MentionResolver resolver;
+    resolver.visit_block(program);
+    resolver.resolve(base);
+}
+
+static void mark_compilable(ASTNode& node, Function<bool(StringView)> const& is_builtin)
+{
+    if (is<FunctionNode>(node)) {
+        auto& function = static_cast<FunctionNode&>(node);
+        if (JitCode::can_compile(function, is_builtin))
+            function.set_compilable();
+    }
+    node.for_each_child([&](auto& child) { mark_compilable(*child, is_builtin); });
+}
+
+void mark_compilable_functions(Vector<NonnullRefPtr<ASTNode>>& program, ContextSnapshot& base)
+{
+    HashTable<String> bound_names;
+    for (auto& node : program)
+        collect_bound_names(*node, bound_names);
+    auto context = base.fork();
+    for (auto& frame : context.scope)
+        frame.for_each([&](String const& name, auto&) { bound_names.set(name); });
+
+    auto is_builtin = [&](StringView name) {
+        return find_builtin(name) && !bound_names.contains(name);
+    };
+    for (auto& node : program)
+        mark_compilable(*node, is_builtin);
+}
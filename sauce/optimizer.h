@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ast.h"
+
+// Replaces calls of pure builtins and native type coercions on constant arguments, and member accesses on constants,
+// by their values.
+// `program` must be the whole program: any name it binds anywhere is assumed to shadow a builtin everywhere. The
+// bindings it starts out with are taken from `base`, in a fork of which the folded expressions are evaluated.
+void fold_constants(Vector<NonnullRefPtr<ASTNode>>& program, ContextSnapshot& base);
+
+// Finds the direct mentions that can only match comments bound earlier in their own block, and has them look those
+// comments up directly instead of scanning every scope. Like fold_constants(), this needs the whole program.
+void resolve_mentions_statically(Vector<NonnullRefPtr<ASTNode>>& program, ContextSnapshot& base);
+
+// Marks the functions the JIT can compile, once they're hot. Needs the whole program to rule out rebound natives.
+void mark_compilable_functions(Vector<NonnullRefPtr<ASTNode>>& program, ContextSnapshot& base);
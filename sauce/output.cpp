@@ -0,0 +1,79 @@
+#include "output.h"
+#include <errno.h>
+#include <sys/uio.h>
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+    : m_fd(fd)
+    , m_capacity(capacity)
+    , m_flush_policy(isatty(fd) ? FlushPolicy::EveryLine : FlushPolicy::WhenFull)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    flush();
+}
+
+void OutputBuffer::append(StringView string)
+{
+    // Large strings are written straight from where they are, along with whatever is pending.
+    if (m_capacity != 0 && string.length() >= m_capacity) {
+        write(m_builder.string_view(), string);
+        m_builder.clear();
+        return;
+    }
+    m_builder.append(string);
+    flush_if_full();
+}
+
+void OutputBuffer::append(char ch)
+{
+    m_builder.append(ch);
+    flush_if_full();
+}
+
+void OutputBuffer::end_line()
+{
+    m_builder.append('\n');
+    if (m_capacity == 0 || m_flush_policy == FlushPolicy::EveryLine)
+        flush();
+    else
+        flush_if_full();
+}
+
+bool OutputBuffer::flush()
+{
+    if (m_builder.is_empty())
+        return true;
+    auto result = write(m_builder.string_view(), {});
+    m_builder.clear();
+    return result;
+}
+
+bool OutputBuffer::write(StringView pending, StringView large)
+{
+    iovec vectors[2] {
+        { const_cast<char*>(pending.characters_without_null_termination()), pending.length() },
+        { const_cast<char*>(large.characters_without_null_termination()), large.length() },
+    };
+    size_t index = 0;
+    while (index < 2) {
+        auto written = ::writev(m_fd, vectors + index, 2 - index);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        // Skip what was written, which may end partway into a vector.
+        auto remaining = static_cast<size_t>(written);
+        while (index < 2 && remaining >= vectors[index].iov_len) {
+            remaining -= vectors[index].iov_len;
+            ++index;
+        }
+        if (index < 2) {
+            vectors[index].iov_base = static_cast<char*>(vectors[index].iov_base) + remaining;
+            vectors[index].iov_len -= remaining;
+        }
+    }
+    return true;
+}
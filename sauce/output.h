@@ -0,0 +1,62 @@
+#pragma once
+
+#include <AK/Format.h>
+#include <AK/Noncopyable.h>
+#include <AK/StringBuilder.h>
+#include <AK/StringView.h>
+#include <unistd.h>
+
+// Collects what a script prints and writes it out in large chunks: once `capacity` bytes are pending, when flushed,
+// and after every line if the output is a terminal. Anything that writes to stderr while a script runs must flush it
+// first, to keep the two in order.
+class OutputBuffer {
+    AK_MAKE_NONCOPYABLE(OutputBuffer);
+    AK_MAKE_NONMOVABLE(OutputBuffer);
+
+public:
+    static constexpr size_t default_capacity = 64 * KiB;
+
+    enum class FlushPolicy {
+        WhenFull,
+        EveryLine,
+    };
+
+    explicit OutputBuffer(int fd = STDOUT_FILENO, size_t capacity = default_capacity);
+    ~OutputBuffer();
+
+    // A capacity of zero flushes after every line.
+    size_t capacity() const { return m_capacity; }
+    void set_capacity(size_t capacity) { m_capacity = capacity; }
+
+    FlushPolicy flush_policy() const { return m_flush_policy; }
+    void set_flush_policy(FlushPolicy policy) { m_flush_policy = policy; }
+
+    void append(StringView);
+    void append(char);
+
+    template<typename... Parameters>
+    void appendff(CheckedFormatString<Parameters...>&& fmtstr, Parameters const&... parameters)
+    {
+        m_builder.appendff(move(fmtstr), parameters...);
+        flush_if_full();
+    }
+
+    void end_line();
+
+    // Returns false if the output could not be written, what was pending is dropped either way.
+    bool flush();
+
+private:
+    void flush_if_full()
+    {
+        if (m_capacity != 0 && m_builder.length() >= m_capacity)
+            flush();
+    }
+
+    bool write(StringView pending, StringView large);
+
+    int m_fd { STDOUT_FILENO };
+    size_t m_capacity { default_capacity };
+    FlushPolicy m_flush_policy { FlushPolicy::WhenFull };
+    StringBuilder m_builder;
+};
@@ -1,9 +1,11 @@
 #include "parser.h"
+#include <AK/StringBuilder.h>
 #include <AK/TypeCasts.h>
 
 Result<Vector<NonnullRefPtr<ASTNode>>, ParseError> Parser::parse_toplevel(bool for_func, bool for_repl)
 {
     Vector<NonnullRefPtr<ASTNode>> nodes;
+    StringBuilder pending_comments;
     for (;;) {
         auto maybe_token = consume();
         if (maybe_token.is_error())
@@ -30,7 +32,35 @@ Result<Vector<NonnullRefPtr<ASTNode>>, ParseError> Parser::parse_toplevel(bool f
         if (peek().type == Token::Type::Semicolon)
             (void)consume();
 
-        nodes.append(static_ptr_cast<ASTNode>(make_ref_counted<Statement>(maybe_node->release_value())));
+        auto node = maybe_node->release_value();
+        if (is<Comment>(*node)) {
+            if (!pending_comments.is_empty())
+                pending_comments.append(" / "sv);
+            pending_comments.append(static_cast<Comment const&>(*node).text().trim_whitespace());
+        } else {
+            RefPtr<FunctionNode> function;
+            String variable_name;
+            if (is<FunctionNode>(*node)) {
+                function = static_ptr_cast<FunctionNode>(node);
+            } else if (is<Assignment>(*node)) {
+                auto& assignment = static_cast<Assignment const&>(*node);
+                if (is<FunctionNode>(*assignment.value())) {
+                    function = static_ptr_cast<FunctionNode>(assignment.value());
+                    variable_name = assignment.variable()->name();
+                }
+            }
+            if (function) {
+                if (!pending_comments.is_empty())
+                    function->set_name(pending_comments.to_string());
+                else if (!variable_name.is_null())
+                    function->set_name(move(variable_name));
+            }
+            pending_comments.clear();
+        }
+
+        auto statement = make_ref_counted<Statement>(move(node));
+        statement->set_position(token.source_range.start);
+        nodes.append(static_ptr_cast<ASTNode>(move(statement)));
 
         if (for_repl)
             break;
@@ -191,7 +221,7 @@ Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_literal()
 
 Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_mention(bool is_direct)
 {
-    (void)consume();
+    auto position = consume().release_value().source_range.start;
     Vector<String> queries;
     if (is_direct) {
         while (peek().type != Token::Type::MentionClose) {
@@ -209,7 +239,9 @@ Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_mention(bool is_direct)
         }
         auto close_type = consume().release_value().type;
         VERIFY(close_type == Token::Type::MentionClose);
-        return static_ptr_cast<ASTNode>(make_ref_counted<DirectMention>(move(queries)));
+        auto mention = make_ref_counted<DirectMention>(move(queries));
+        mention->set_position(position);
+        return static_ptr_cast<ASTNode>(move(mention));
     } else {
         auto query = parse_expression();
         if (query.is_error())
@@ -222,8 +254,8 @@ Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_mention(bool is_direct)
 
 Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_function()
 {
-    auto brace = consume().release_value().type;
-    VERIFY(brace == Token::Type::OpenBrace);
+    auto brace = consume().release_value();
+    VERIFY(brace.type == Token::Type::OpenBrace);
     Vector<NonnullRefPtr<Variable>> parameters;
     RefPtr<Variable> return_;
 
@@ -255,13 +287,16 @@ Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_function()
     if (body.is_error())
         return body.release_error();
 
-    return static_ptr_cast<ASTNode>(make_ref_counted<FunctionNode>(move(parameters), move(return_), body.release_value()));
+    auto function = make_ref_counted<FunctionNode>(move(parameters), move(return_), body.release_value());
+    function->set_position(brace.source_range.start);
+    function->set_name(String::formatted("<anonymous {}:{}>", brace.source_range.start.line, brace.source_range.start.column));
+    return static_ptr_cast<ASTNode>(move(function));
 }
 
 Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_call(NonnullRefPtr<ASTNode> callee)
 {
-    auto open_paren_type = consume().release_value().type;
-    VERIFY(open_paren_type == Token::Type::OpenParen);
+    auto open_paren = consume().release_value();
+    VERIFY(open_paren.type == Token::Type::OpenParen);
 
     Vector<AK::NonnullRefPtr<ASTNode>> arguments;
     while (peek().type != Token::Type::CloseParen) {
@@ -276,7 +311,9 @@ Result<NonnullRefPtr<ASTNode>, ParseError> Parser::parse_call(NonnullRefPtr<ASTN
     }
 
     (void)consume();
-    return static_ptr_cast<ASTNode>(make_ref_counted<Call>(move(callee), move(arguments)));
+    auto call = make_ref_counted<Call>(move(callee), move(arguments));
+    call->set_position(open_paren.source_range.start);
+    return static_ptr_cast<ASTNode>(move(call));
 }
 
 Result<NonnullRefPtr<Variable>, ParseError> Parser::parse_variable()
@@ -0,0 +1,118 @@
+#include "profiler.h"
+#include <AK/Format.h>
+#include <AK/QuickSort.h>
+#include <AK/StringBuilder.h>
+#include <AK/Time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+volatile sig_atomic_t Profiler::s_sample_pending = 0;
+
+static i64 now_ns()
+{
+    return Time::now_monotonic().to_nanoseconds();
+}
+
+Profiler::Profiler(bool exact, u32 sample_interval_us)
+    : m_exact(exact)
+{
+    struct sigaction action { };
+    action.sa_handler = handle_timer;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    itimerval interval {
+        .it_interval = { .tv_sec = 0, .tv_usec = static_cast<suseconds_t>(sample_interval_us) },
+        .it_value = { .tv_sec = 0, .tv_usec = static_cast<suseconds_t>(sample_interval_us) },
+    };
+    setitimer(ITIMER_PROF, &interval, nullptr);
+}
+
+Profiler::~Profiler()
+{
+    itimerval disabled {};
+    setitimer(ITIMER_PROF, &disabled, nullptr);
+    signal(SIGPROF, SIG_DFL);
+}
+
+void Profiler::handle_timer(int)
+{
+    s_sample_pending = 1;
+}
+
+void Profiler::enter(void const* key, StringView name)
+{
+    m_stack.append({ key, name, m_exact ? now_ns() : 0, 0 });
+}
+
+void Profiler::leave()
+{
+    auto frame = m_stack.take_last();
+    if (!m_exact)
+        return;
+
+    auto elapsed = now_ns() - frame.start_ns;
+    if (!m_stack.is_empty())
+        m_stack.last().child_ns += elapsed;
+
+    auto& statistics = m_function_statistics.ensure(frame.key);
+    statistics.name = frame.name;
+    ++statistics.calls;
+    statistics.exclusive_ns += elapsed - frame.child_ns;
+    // Only the outermost activation of a recursive function counts towards its inclusive time.
+    for (auto& entry : m_stack) {
+        if (entry.key == frame.key)
+            return;
+    }
+    statistics.inclusive_ns += elapsed;
+}
+
+void Profiler::take_sample()
+{
+    s_sample_pending = 0;
+    ++m_sample_count;
+
+    StringBuilder builder;
+    builder.append("<toplevel>"sv);
+    for (auto& frame : m_stack) {
+        builder.append(';');
+        // Semicolons separate frames in the folded format.
+        for (auto ch : frame.name)
+            builder.append(ch == ';' ? ',' : ch);
+    }
+
+    auto& count = m_folded_samples.ensure(builder.to_string());
+    ++count;
+}
+
+bool Profiler::write_folded_stacks(String const& path) const
+{
+    auto file = fopen(path.characters(), "w");
+    if (!file) {
+        warnln("Failed to open {}: {}", path, strerror(errno));
+        return false;
+    }
+    for (auto& entry : m_folded_samples)
+        fprintf(file, "%s %zu\n", entry.key.characters(), entry.value);
+    fclose(file);
+    return true;
+}
+
+void Profiler::dump_function_statistics() const
+{
+    warnln("Profile: {} samples", m_sample_count);
+    if (!m_exact)
+        return;
+
+    Vector<FunctionStatistics> functions;
+    for (auto& entry : m_function_statistics)
+        functions.append(entry.value);
+    quick_sort(functions, [](auto& a, auto& b) { return a.inclusive_ns > b.inclusive_ns; });
+
+    warnln("{:>10} {:>14} {:>14}  function", "calls", "inclusive(us)", "exclusive(us)");
+    for (auto& function : functions)
+        warnln("{:>10} {:>14} {:>14}  {}", function.calls, function.inclusive_ns / 1000, function.exclusive_ns / 1000, function.name);
+}
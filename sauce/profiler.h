@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Vector.h"
+#include <AK/HashMap.h>
+#include <AK/Noncopyable.h>
+#include <AK/String.h>
+#include <AK/StringView.h>
+#include <signal.h>
+
+// Samples the interpreter's own call stack (user functions and natives, as named by their describing comments) on a
+// CPU-time timer, and optionally keeps exact call counts and timings per function.
+// The timer only raises a flag, the stack is walked at the next node the interpreter runs.
+class Profiler {
+    AK_MAKE_NONCOPYABLE(Profiler);
+    AK_MAKE_NONMOVABLE(Profiler);
+
+public:
+    static constexpr u32 default_sample_interval_us = 1000;
+
+    explicit Profiler(bool exact, u32 sample_interval_us = default_sample_interval_us);
+    ~Profiler();
+
+    void enter(void const* key, StringView name);
+    void leave();
+
+    void poll()
+    {
+        if (s_sample_pending) [[unlikely]]
+            take_sample();
+    }
+
+    bool write_folded_stacks(String const& path) const;
+    void dump_function_statistics() const;
+
+private:
+    struct Frame {
+        void const* key { nullptr };
+        StringView name;
+        i64 start_ns { 0 };
+        i64 child_ns { 0 };
+    };
+
+    struct FunctionStatistics {
+        StringView name;
+        size_t calls { 0 };
+        i64 inclusive_ns { 0 };
+        i64 exclusive_ns { 0 };
+    };
+
+    static void handle_timer(int);
+    void take_sample();
+
+    static volatile sig_atomic_t s_sample_pending;
+
+    bool m_exact { false };
+    Vector<Frame> m_stack;
+    HashMap<String, size_t> m_folded_samples;
+    HashMap<void const*, FunctionStatistics> m_function_statistics;
+    size_t m_sample_count { 0 };
+};
@@ -0,0 +1,151 @@
+#include "sequence.h"
+#include "builtins.h"
+
+ElementCall::ElementCall(Context const& context, Value function)
+    : m_function(move(function))
+    , m_inline_call(InlineCall::create(context, m_function))
+    , m_call(make_ref_counted<Call>(make_ref_counted<SyntheticNode>(m_function), Vector<NonnullRefPtr<ASTNode>> {}))
+{
+}
+
+Value ElementCall::call(Context& context, Value argument)
+{
+    if (m_inline_call.has_value())
+        return m_inline_call->call(context, move(argument));
+    m_arguments.clear_with_capacity();
+    m_arguments.append(move(argument));
+    return m_call->call(context, m_function, m_arguments);
+}
+
+Value ElementCall::call(Context& context, Value first, Value second)
+{
+    m_arguments.clear_with_capacity();
+    m_arguments.append(move(first));
+    m_arguments.append(move(second));
+    return m_call->call(context, m_function, m_arguments);
+}
+
+SequenceIterator::SequenceIterator(Context& context, NonnullRefPtr<Sequence> sequence)
+    : m_context(context)
+    , m_sequence(move(sequence))
+{
+    for (auto& stage : m_sequence->stages) {
+        StageState state;
+        if (stage.kind == Sequence::StageKind::Take)
+            state.remaining = stage.count;
+        else
+            state.call = ElementCall { m_context, stage.function };
+        m_stages.append(move(state));
+    }
+
+    if (auto range = m_sequence->source.get_pointer<Sequence::Range>())
+        m_next_in_range = range->start;
+    else if (auto generator = m_sequence->source.get_pointer<Sequence::Generator>())
+        m_generator_step = ElementCall { m_context, generator->step };
+    else if (auto record = m_sequence->source.get<Value>().value.get_pointer<RecordValue>()) {
+        // Lists lead with their length, which isn't one of their elements.
+        auto members = record->type->decl.get_pointer<Vector<TypeName>>();
+        if (members && !members->is_empty() && members->first().name == "length"sv)
+            m_position = 1;
+    }
+}
+
+Optional<Value> SequenceIterator::next_from_source()
+{
+    if (m_source_ended)
+        return {};
+
+    auto end = [&]() -> Optional<Value> {
+        m_source_ended = true;
+        return {};
+    };
+
+    if (auto range = m_sequence->source.get_pointer<Sequence::Range>()) {
+        if (range->step > 0 ? m_next_in_range >= range->end : m_next_in_range <= range->end)
+            return end();
+        auto value = m_next_in_range;
+        if (__builtin_add_overflow(m_next_in_range, range->step, &m_next_in_range))
+            m_source_ended = true;
+        return Value { NumberType(value) };
+    }
+
+    if (auto generator = m_sequence->source.get_pointer<Sequence::Generator>()) {
+        // The step is only applied once the next value is asked for.
+        auto value = m_last_generated.has_value() ? m_generator_step->call(m_context, m_last_generated.release_value()) : generator->seed;
+        if (value.value.has<Empty>())
+            return end();
+        m_last_generated = value;
+        return value;
+    }
+
+    auto& source = m_sequence->source.get<Value>();
+    auto position = m_position++;
+    return source.value.visit(
+        [&](String const& string) -> Optional<Value> {
+            if (position >= string.length())
+                return end();
+            return Value { m_context.track(String::repeated(string[position], 1)) };
+        },
+        [&](MappedString const& string) -> Optional<Value> {
+            if (position >= string.length)
+                return end();
+            return Value { m_context.track(String::repeated(string.view()[position], 1)) };
+        },
+        [&](RecordValue const& record) -> Optional<Value> {
+            if (position >= record.members->values.size())
+                return end();
+            return record.members->values[position];
+        },
+        [&](NonnullRefPtr<CommentResolutionSet> const& set) -> Optional<Value> {
+            // Values of a deferred set are only computed as they're reached.
+            if (position >= set->size())
+                return end();
+            return set->at(m_context, position);
+        },
+        [&](auto const&) -> Optional<Value> { return end(); });
+}
+
+Optional<Value> SequenceIterator::next()
+{
+    for (;;) {
+        if (m_context.error.has_value())
+            return {};
+        // Nothing can get past a Take that has let through all it will, so the source isn't even asked.
+        for (auto& stage : m_stages) {
+            if (!stage.call.has_value() && stage.remaining == 0)
+                return {};
+        }
+
+        auto value = next_from_source();
+        if (!value.has_value())
+            return {};
+        ++m_context.statistics.sequence_values;
+
+        auto passed = true;
+        for (size_t i = 0; i < m_stages.size() && passed; ++i) {
+            auto& stage = m_stages[i];
+            switch (m_sequence->stages[i].kind) {
+            case Sequence::StageKind::Map:
+                value = stage.call->call(m_context, value.release_value());
+                break;
+            case Sequence::StageKind::Filter:
+                passed = truth(m_context, stage.call->call(m_context, *value));
+                break;
+            case Sequence::StageKind::Take:
+                --stage.remaining;
+                break;
+            }
+        }
+        if (passed)
+            return value;
+    }
+}
+
+RefPtr<Sequence> as_sequence(Value const& value)
+{
+    if (auto sequence = value.value.get_pointer<NonnullRefPtr<Sequence>>())
+        return *sequence;
+    if (value.value.has<String>() || value.value.has<MappedString>() || value.value.has<RecordValue>() || value.value.has<NonnullRefPtr<CommentResolutionSet>>())
+        return make_ref_counted<Sequence>(value, Vector<Sequence::Stage> {});
+    return nullptr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ast.h"
+
+// Calls a function on values of a sequence, one at a time. What calling it needs is set up once rather than per value:
+// small one-parameter closures are called inline, anything else through a single call node.
+class ElementCall {
+public:
+    ElementCall(Context const&, Value function);
+
+    Value call(Context&, Value argument);
+    Value call(Context&, Value first, Value second);
+
+private:
+    Value m_function;
+    Optional<InlineCall> m_inline_call;
+    NonnullRefPtr<Call> m_call;
+    Vector<Value> m_arguments;
+};
+
+// Pulls the values of a sequence out of its source, one at a time, through each of its stages.
+class SequenceIterator {
+public:
+    SequenceIterator(Context&, NonnullRefPtr<Sequence>);
+
+    // Nothing once the sequence has ended, or execution has been abandoned.
+    Optional<Value> next();
+
+private:
+    struct StageState {
+        Optional<ElementCall> call;
+        size_t remaining { 0 };
+    };
+
+    Optional<Value> next_from_source();
+
+    Context& m_context;
+    NonnullRefPtr<Sequence> m_sequence;
+    Vector<StageState> m_stages;
+    bool m_source_ended { false };
+    size_t m_position { 0 };
+    i64 m_next_in_range { 0 };
+    Optional<ElementCall> m_generator_step;
+    Optional<Value> m_last_generated;
+};
+
+// `value` if it's a sequence, or the sequence of its characters, members or values; null if it's none of those.
+RefPtr<Sequence> as_sequence(Value const& value);
@@ -0,0 +1,378 @@
+#include "server.h"
+#include <AK/ScopeGuard.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A request is this byte, sent along with the client's stdout and stderr, followed by the source of the script up to
+// where the client shuts down its end. The server answers with the exit status, as a single byte.
+static constexpr u8 request_tag = 'R';
+
+// Clients that haven't sent all of their request by then are dropped.
+static constexpr u64 request_timeout_ms = 10'000;
+
+static bool make_address(StringView path, sockaddr_un& address)
+{
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(address.sun_path)) {
+        warnln("Socket path {} is too long", path);
+        return false;
+    }
+    memcpy(address.sun_path, path.characters_without_null_termination(), path.length());
+    return true;
+}
+
+static bool send_all(int fd, StringView data)
+{
+    while (!data.is_empty()) {
+        auto sent = send(fd, data.characters_without_null_termination(), data.length(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data = data.substring_view(sent);
+    }
+    return true;
+}
+
+static bool send_request_header(int server)
+{
+    u8 tag = request_tag;
+    iovec iov { &tag, 1 };
+    int fds[2] { STDOUT_FILENO, STDERR_FILENO };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] {};
+
+    msghdr message {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(server, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == 1;
+}
+
+// Receives the client's stdout and stderr into `fds`. Fails with EAGAIN if the header hasn't arrived yet.
+static bool receive_request_header(int client, int (&fds)[2])
+{
+    u8 tag = 0;
+    iovec iov { &tag, 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] {};
+
+    msghdr message {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0)
+        return false;
+
+    auto header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        errno = EPROTO;
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    if (received != 1 || tag != request_tag) {
+        close(fds[0]);
+        close(fds[1]);
+        errno = EPROTO;
+        return false;
+    }
+    return true;
+}
+
+// A client whose request is still coming in.
+struct Connection {
+    int client { -1 };
+    int fds[2] { -1, -1 };
+    bool has_header { false };
+    StringBuilder source;
+    Optional<u64> timeout;
+};
+
+// Reads requests off connections as their data comes in, and starts the script in each once all of it is there, so
+// that no client can hold up the scripts a worker has in flight.
+class RequestReader {
+public:
+    explicit RequestReader(Interpreter& interpreter)
+        : m_interpreter(interpreter)
+    {
+    }
+
+    void accept_from(int listen_fd)
+    {
+        for (;;) {
+            auto client = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (errno != EAGAIN)
+                    warnln("Failed to accept a connection: {}", strerror(errno));
+                return;
+            }
+            add(client);
+        }
+    }
+
+private:
+    void add(int client)
+    {
+        auto& event_loop = m_interpreter.event_loop();
+        auto connection = make<Connection>();
+        connection->client = client;
+        connection->timeout = event_loop.add_timeout(request_timeout_ms, [this, client] { drop(client); });
+        if (!connection->timeout.has_value() || !event_loop.watch(client, [this, client] { read_from(client); })) {
+            warnln("Failed to wait on a connection: {}", strerror(errno));
+            if (connection->timeout.has_value())
+                event_loop.cancel_timeout(*connection->timeout);
+            close(client);
+            return;
+        }
+        m_connections.set(client, move(connection));
+    }
+
+    void read_from(int client)
+    {
+        auto& connection = *m_connections.get(client).value();
+        if (!connection.has_header) {
+            if (!receive_request_header(client, connection.fds)) {
+                if (errno != EAGAIN)
+                    drop(client);
+                return;
+            }
+            connection.has_header = true;
+        }
+
+        char buffer[16 * KiB];
+        for (;;) {
+            auto received = recv(client, buffer, sizeof(buffer), 0);
+            if (received < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN)
+                    drop(client);
+                return;
+            }
+            if (received == 0)
+                break;
+            connection.source.append(StringView { buffer, static_cast<size_t>(received) });
+        }
+        start(client);
+    }
+
+    // Starts the script a client sent, and answers once it's finished; the script takes over the client's socket.
+    void start(int client)
+    {
+        auto& event_loop = m_interpreter.event_loop();
+        auto connection = take(client);
+        event_loop.unwatch(client);
+        event_loop.cancel_timeout(*connection->timeout);
+
+        int fds[2] { connection->fds[0], connection->fds[1] };
+        m_interpreter.start(connection->source.string_view(), fds[0], fds[1], [client, fds](int exit_status) {
+            u8 status = exit_status;
+            send_all(client, StringView { reinterpret_cast<char const*>(&status), 1 });
+            close(fds[0]);
+            close(fds[1]);
+            close(client);
+        });
+    }
+
+    void drop(int client)
+    {
+        auto& event_loop = m_interpreter.event_loop();
+        auto connection = take(client);
+        event_loop.unwatch(client);
+        event_loop.cancel_timeout(*connection->timeout);
+        if (connection->has_header) {
+            close(connection->fds[0]);
+            close(connection->fds[1]);
+        }
+        close(client);
+    }
+
+    NonnullOwnPtr<Connection> take(int client)
+    {
+        auto connection = move(m_connections.find(client)->value);
+        m_connections.remove(client);
+        return connection;
+    }
+
+    Interpreter& m_interpreter;
+    HashMap<int, NonnullOwnPtr<Connection>> m_connections;
+};
+
+// Accepts connections as they come in, and runs their scripts until they're waiting on the event loop, so that a
+// worker keeps any number of them in flight.
+static void serve_requests(int listen_fd, Interpreter& interpreter)
+{
+    auto& event_loop = interpreter.event_loop();
+    RequestReader reader { interpreter };
+    if (!event_loop.watch(listen_fd, [&] { reader.accept_from(listen_fd); })) {
+        warnln("Failed to wait for connections: {}", strerror(errno));
+        return;
+    }
+    while (event_loop.run_once())
+        ;
+    event_loop.unwatch(listen_fd);
+}
+
+struct Server {
+    int listen_fd { -1 };
+    Interpreter::Options options;
+};
+
+static void* run_worker(void* argument)
+{
+    auto& server = *static_cast<Server const*>(argument);
+    // The prelude already parsed once, on the main thread, but the worker may still run out of file descriptors.
+    auto interpreter = Interpreter::create(server.options);
+    if (interpreter.is_error()) {
+        warnln("Failed to start a worker: {}", interpreter.error());
+        return nullptr;
+    }
+    serve_requests(server.listen_fd, *interpreter.value());
+    return nullptr;
+}
+
+static int listen_on(StringView path)
+{
+    sockaddr_un address;
+    if (!make_address(path, address))
+        return -1;
+
+    // Workers woken up for a connection another one already took must find nothing to accept, rather than block.
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        warnln("Failed to create a socket: {}", strerror(errno));
+        return -1;
+    }
+
+    auto bound = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    if (!bound && errno == EADDRINUSE) {
+        // Take over the socket of a server that's gone, but not one that's still listening.
+        auto probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        auto is_stale = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 && errno == ECONNREFUSED;
+        if (probe >= 0)
+            close(probe);
+        if (is_stale && unlink(address.sun_path) == 0)
+            bound = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        else
+            errno = EADDRINUSE;
+    }
+    if (!bound || listen(fd, SOMAXCONN) < 0) {
+        warnln("Failed to listen on {}: {}", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(StringView path, Interpreter::Options const& options, size_t workers)
+{
+    auto interpreter = Interpreter::create(options);
+    if (interpreter.is_error()) {
+        warnln("{}", interpreter.error());
+        return 1;
+    }
+
+    // Clients going away mid-script must not take the server with them.
+    signal(SIGPIPE, SIG_IGN);
+
+    auto listen_fd = listen_on(path);
+    if (listen_fd < 0)
+        return 1;
+    // Workers are detached, so what they share is never freed, in case they're still running once this returns.
+    auto& server = *new Server { listen_fd, options };
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, Interpreter::thread_stack_size);
+    // The main thread is a worker too.
+    for (size_t i = 1; i < workers; ++i) {
+        pthread_t thread;
+        if (auto rc = pthread_create(&thread, &attributes, run_worker, &server); rc != 0) {
+            warnln("Failed to start a worker: {}", strerror(rc));
+            break;
+        }
+        pthread_detach(thread);
+    }
+    pthread_attr_destroy(&attributes);
+
+    serve_requests(server.listen_fd, *interpreter.value());
+    close(server.listen_fd);
+    return 1;
+}
+
+int run_on_server(StringView path, char const* source_file)
+{
+    sockaddr_un address;
+    if (!make_address(path, address))
+        return 1;
+
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        warnln("Failed to connect to {}: {}", path, strerror(errno));
+        return 1;
+    }
+    ScopeGuard close_fd = [&] { close(fd); };
+
+    RefPtr<MappedFile> file;
+    StringBuilder stdin_source;
+    StringView source;
+    if (source_file == "-"sv) {
+        char buffer[16 * KiB];
+        for (;;) {
+            auto nread = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (nread < 0 && errno == EINTR)
+                continue;
+            if (nread <= 0)
+                break;
+            stdin_source.append(StringView { buffer, static_cast<size_t>(nread) });
+        }
+        source = stdin_source.string_view();
+    } else {
+        file = MappedFile::map(source_file);
+        if (!file) {
+            warnln("Failed to open {}: {}", source_file, strerror(errno));
+            return 1;
+        }
+        source = file->bytes();
+    }
+
+    if (!send_request_header(fd) || !send_all(fd, source) || shutdown(fd, SHUT_WR) < 0) {
+        warnln("Failed to send {} to {}: {}", source_file, path, strerror(errno));
+        return 1;
+    }
+
+    u8 status = 0;
+    ssize_t received;
+    do {
+        received = recv(fd, &status, 1, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received != 1) {
+        warnln("{} closed the connection before the script finished", path);
+        return 1;
+    }
+    return status;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "interpreter.h"
+
+// Serves scripts sent to the Unix socket at `path` on `workers` threads, each with an interpreter of its own, until
+// killed. A client passes its stdout and stderr along with the source of a script, which prints straight to them; its
+// exit status is sent back once it's done, including any callbacks it's waiting on. A worker runs another script while
+// one waits, so it can have many in flight. Returns only if the socket can't be set up or stops accepting connections.
+int serve(StringView path, Interpreter::Options const&, size_t workers);
+
+// Runs the script at `source_file` (or stdin, for `-`) on the server listening at `path`, and returns its exit status.
+int run_on_server(StringView path, char const* source_file);
@@ -0,0 +1,76 @@
+#include "statistics.h"
+#include "types.h"
+#include <AK/Format.h>
+#include <AK/StringBuilder.h>
+
+void RuntimeStatistics::dump(Heap const& heap) const
+{
+    warnln("Statistics:");
+    warnln("  calls: {} user ({} tail, {} compiled, {} deoptimized), {} native", user_calls, tail_calls, compiled_calls, deoptimizations, native_calls);
+    warnln("  type feedback: {} specialized executions, {} sites despecialized", specialized_executions, despecializations);
+    warnln("  closures: {} created, capturing {} frames and {} bindings", closures_created, captured_frames, captured_bindings);
+    warnln("  loop iterations: {}", loop_iterations);
+    warnln("  sequences: {} values pulled from their sources", sequence_values);
+    warnln("  memo: {} hits, {} misses, {} evictions", memo_hits, memo_misses, memo_evictions);
+    warnln("  mentions: {} resolved, {} candidates examined", mentions_resolved, mention_candidates_examined);
+    warnln("  resolution sets: {} deferred, {} of their values computed", sets_deferred, deferred_values_computed);
+
+    StringBuilder depths;
+    for (size_t i = 0; i < lookup_depth_buckets; ++i)
+        depths.appendff("{}{}: {}{}", i, i == lookup_depth_buckets - 1 ? "+" : "", lookups_by_depth[i], i == lookup_depth_buckets - 1 ? "" : ", ");
+    warnln("  scope lookups by depth: {}", depths.to_string());
+    warnln("  other lookups: {} builtin, {} unresolved", builtin_lookups, unresolved_lookups);
+
+    warnln("  allocations:");
+    for (u8 kind = 0; kind < to_underlying(AllocationKind::__Count); ++kind)
+        warnln("    {}: {}", to_string(static_cast<AllocationKind>(kind)), heap.usage(static_cast<AllocationKind>(kind)).allocations);
+
+    if (slowest_statements.is_empty())
+        return;
+    warnln("  slowest top-level statements:");
+    for (auto& timing : slowest_statements)
+        warnln("    {}:{}: {}us", timing.position.line, timing.position.column, timing.ns / 1000);
+}
+
+void RuntimeStatistics::did_run_statement(Token::Position position, u64 ns)
+{
+    if (slowest_statements.size() == slowest_statements_kept && slowest_statements.last().ns >= ns)
+        return;
+    size_t index = 0;
+    while (index < slowest_statements.size() && slowest_statements[index].ns >= ns)
+        ++index;
+    slowest_statements.insert(index, { position, ns });
+    if (slowest_statements.size() > slowest_statements_kept)
+        slowest_statements.take_last();
+}
+
+Value RuntimeStatistics::to_value(Heap const& heap) const
+{
+    Vector<TypeName> fields;
+    Vector<Value> values;
+    auto add = [&](String name, u64 value) {
+        fields.append({ .name = move(name), .type = make_ref_counted<Type>(NativeType::Int) });
+        values.append({ static_cast<i64>(value) });
+    };
+
+    add("user_calls", user_calls);
+    add("tail_calls", tail_calls);
+    add("native_calls", native_calls);
+    add("compiled_calls", compiled_calls);
+    add("specialized", specialized_executions);
+    add("closures", closures_created);
+    add("captured_bindings", captured_bindings);
+    add("loop_iterations", loop_iterations);
+    add("memo_hits", memo_hits);
+    add("memo_misses", memo_misses);
+    add("mentions", mentions_resolved);
+    add("mention_candidates", mention_candidates_examined);
+    u64 lookups = builtin_lookups + unresolved_lookups;
+    for (auto count : lookups_by_depth)
+        lookups += count;
+    add("lookups", lookups);
+    add("allocations", heap.total_usage().allocations);
+    add("bytes", heap.total_usage().current);
+
+    return { RecordValue::create(make_ref_counted<Type>(move(fields)), move(values)) };
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Vector.h"
+#include "lexer.h"
+#include <AK/Types.h>
+
+class Heap;
+struct Value;
+
+// Counters for the interpreter's hot paths; cheap enough to always be kept, and reported by `--stats` or `stats()`.
+struct RuntimeStatistics {
+    // Scope lookups by how many frames out from the innermost one the name was found, the last bucket holds the rest.
+    static constexpr size_t lookup_depth_buckets = 8;
+    static constexpr size_t slowest_statements_kept = 10;
+
+    struct StatementTiming {
+        Token::Position position;
+        u64 ns { 0 };
+    };
+
+    u64 lookups_by_depth[lookup_depth_buckets] {};
+    u64 builtin_lookups { 0 };
+    u64 unresolved_lookups { 0 };
+    u64 mentions_resolved { 0 };
+    u64 mention_candidates_examined { 0 };
+    u64 user_calls { 0 };
+    u64 tail_calls { 0 };
+    u64 native_calls { 0 };
+    u64 compiled_calls { 0 };
+    u64 deoptimizations { 0 };
+    u64 specialized_executions { 0 };
+    u64 despecializations { 0 };
+    u64 closures_created { 0 };
+    u64 captured_frames { 0 };
+    u64 captured_bindings { 0 };
+    u64 loop_iterations { 0 };
+    u64 sequence_values { 0 };
+    u64 memo_hits { 0 };
+    u64 memo_misses { 0 };
+    u64 memo_evictions { 0 };
+    u64 sets_deferred { 0 };
+    u64 deferred_values_computed { 0 };
+    // The slowest top-level statements so far, slowest first; a REPL session may run any number of them.
+    Vector<StatementTiming> slowest_statements;
+
+    void did_look_up(size_t depth) { ++lookups_by_depth[min(depth, lookup_depth_buckets - 1)]; }
+    void did_run_statement(Token::Position, u64 ns);
+
+    void dump(Heap const&) const;
+    Value to_value(Heap const&) const;
+};
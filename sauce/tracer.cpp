@@ -0,0 +1,84 @@
+#include "tracer.h"
+#include <AK/Format.h>
+#include <AK/StringBuilder.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+Tracer::Tracer(String path, size_t capacity)
+    : m_path(move(path))
+    , m_capacity(capacity)
+    , m_origin_ns(now())
+{
+}
+
+Tracer::~Tracer()
+{
+    flush();
+}
+
+void Tracer::complete(StringView category, StringView name, i64 start_ns, String args)
+{
+    auto end_ns = now();
+    if (m_events.size() == m_capacity) {
+        ++m_dropped_events;
+        return;
+    }
+    m_events.append({ category, name, start_ns - m_origin_ns, end_ns - start_ns, move(args) });
+}
+
+String Tracer::escape(StringView string)
+{
+    StringBuilder builder;
+    for (auto ch : string) {
+        switch (ch) {
+        case '"':
+            builder.append("\\\""sv);
+            break;
+        case '\\':
+            builder.append("\\\\"sv);
+            break;
+        case '\n':
+            builder.append("\\n"sv);
+            break;
+        default:
+            if (static_cast<u8>(ch) < 0x20)
+                builder.appendff("\\u{:04x}", static_cast<u8>(ch));
+            else
+                builder.append(ch);
+        }
+    }
+    return builder.to_string();
+}
+
+bool Tracer::flush() const
+{
+    auto file = fopen(m_path.characters(), "w");
+    if (!file) {
+        warnln("Failed to open {}: {}", m_path, strerror(errno));
+        return false;
+    }
+
+    auto pid = getpid();
+    fputs("{\"traceEvents\":[", file);
+    for (size_t i = 0; i < m_events.size(); ++i) {
+        auto& event = m_events[i];
+        // Timestamps are in microseconds.
+        auto line = String::formatted("{}{{\"ph\":\"X\",\"pid\":{},\"tid\":1,\"cat\":\"{}\",\"name\":\"{}\",\"ts\":{}.{:03},\"dur\":{}.{:03},\"args\":{{{}}}}}",
+            i == 0 ? "" : ",\n",
+            pid,
+            event.category,
+            escape(event.name),
+            event.start_ns / 1000, event.start_ns % 1000,
+            event.duration_ns / 1000, event.duration_ns % 1000,
+            event.args);
+        fwrite(line.characters(), 1, line.length(), file);
+    }
+    fprintf(file, "],\n\"otherData\":{\"dropped_events\":%zu}}\n", m_dropped_events);
+    fclose(file);
+
+    if (m_dropped_events != 0)
+        warnln("Trace buffer full, {} events were dropped", m_dropped_events);
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Vector.h"
+#include <AK/Noncopyable.h>
+#include <AK/String.h>
+#include <AK/StringView.h>
+#include <AK/Time.h>
+
+// Records duration events in the Chrome trace_event format (viewable in Perfetto or chrome://tracing).
+// The buffer holds at most `capacity` events, later ones are dropped and counted; it's written out when the tracer is
+// destroyed.
+class Tracer {
+    AK_MAKE_NONCOPYABLE(Tracer);
+    AK_MAKE_NONMOVABLE(Tracer);
+
+public:
+    static constexpr size_t default_capacity = 1'000'000;
+
+    explicit Tracer(String path, size_t capacity = default_capacity);
+    ~Tracer();
+
+    static i64 now() { return Time::now_monotonic().to_nanoseconds(); }
+
+    // `args` must be the members of a JSON object, without the braces.
+    void complete(StringView category, StringView name, i64 start_ns, String args = {});
+
+    static String escape(StringView);
+
+private:
+    struct Event {
+        StringView category;
+        String name;
+        i64 start_ns { 0 };
+        i64 duration_ns { 0 };
+        String args;
+    };
+
+    bool flush() const;
+
+    String m_path;
+    size_t m_capacity { 0 };
+    i64 m_origin_ns { 0 };
+    Vector<Event> m_events;
+    size_t m_dropped_events { 0 };
+};
@@ -1,9 +1,17 @@
 #pragma once
 
 #include "Vector.h"
+#include "heap.h"
+#include "mapped_file.h"
+#include "output.h"
+#include "profiler.h"
+#include "statistics.h"
+#include "tracer.h"
 #include <AK/HashMap.h>
 #include <AK/OwnPtr.h>
+#include <AK/Span.h>
 #include <AK/String.h>
+#include <AK/StringView.h>
 #include <AK/UFixedBigInt.h>
 #include <AK/Variant.h>
 #include <cmath>
@@ -113,37 +121,206 @@ struct TypeName {
     NonnullRefPtr<Type> type;
 };
 
-struct Type : public RefCounted<Type> {
+struct Type : public RefCountedCell<Type, AllocationKind::Type> {
     Type(Variant<Vector<TypeName>, NativeType> decl)
         : decl(move(decl))
     {
+        if (auto members = this->decl.get_pointer<Vector<TypeName>>()) {
+            for (auto& member : *members)
+                account_member(member);
+        }
     }
 
+    // Adds a member to a record type in place, charging its storage to the type's heap.
+    void append_member(TypeName member)
+    {
+        account_member(member);
+        decl.get<Vector<TypeName>>().append(move(member));
+    }
+
+    virtual void visit_edges(HeapCell::Visitor&) const override;
+    virtual void clear_edges() override;
+
     Variant<Vector<TypeName>, NativeType> decl;
+
+private:
+    void account_member(TypeName const& member) { account(sizeof(TypeName) + member.name.length()); }
 };
 
 struct CommentResolutionSet;
+struct Sequence;
 struct Context;
 struct FunctionNode;
+class ASTNode;
 
 struct Value;
+struct RecordMembers;
 struct RecordValue {
     NonnullRefPtr<Type> type;
-    Vector<Value> members;
+    NonnullRefPtr<RecordMembers> members;
+
+    static RecordValue create(NonnullRefPtr<Type>, Vector<Value> members);
 };
 
+using NativeFunction = Value (*)(Context&, void*, size_t);
+// Takes the argument expressions of a call unevaluated, and evaluates only those it needs.
+using LazyNativeFunction = Value (*)(Context&, Span<NonnullRefPtr<ASTNode> const>);
+
 struct NativeFunctionType {
-    Value (*fn)(Context&, void*, size_t);
+    NativeFunction fn;
+
+    Span<StringView const> comment_words;
 
-    Vector<String> comments;
+    // Used instead of `fn` where a call names the native directly.
+    LazyNativeFunction lazy_fn { nullptr };
 };
 
 struct Comment;
 
+void visit_value_edges(Value const&, HeapCell::Visitor&);
+void visit_value_edges(Vector<Value> const&, HeapCell::Visitor&);
+
+// Storage a binding's value owns outside of the frame's own table.
+inline size_t storage_size(Value const&);
+inline size_t storage_size(Vector<Value> const&);
+
+// The bindings of a scope frame. Once a frame is shared, writes go to a new layer over it rather than to a copy, and
+// a layer is merged with the one below once it holds as many bindings, so that frames are only ever a few layers deep
+// and each binding is copied a logarithmic number of times at most.
+template<typename T>
+struct SharedFrame : public RefCountedCell<SharedFrame<T>, AllocationKind::Scope> {
+    SharedFrame() = default;
+    explicit SharedFrame(RefPtr<SharedFrame> base)
+        : base(move(base))
+        , size(this->base ? this->base->size : 0)
+    {
+    }
+
+    // The top two layers of `top` as one.
+    static NonnullRefPtr<SharedFrame> merged(SharedFrame const& top)
+    {
+        auto frame = make_ref_counted<SharedFrame>(top.base->base);
+        for (auto& entry : top.base->bindings)
+            frame->set(entry.key, entry.value);
+        for (auto& entry : top.bindings)
+            frame->set(entry.key, entry.value);
+        return frame;
+    }
+
+    template<typename K>
+    auto find(K const& key) const
+    {
+        auto* layer = this;
+        auto it = bindings.find(key);
+        while (it == layer->bindings.end() && layer->base) {
+            layer = layer->base.ptr();
+            it = layer->bindings.find(key);
+        }
+        return it == layer->bindings.end() ? nullptr : &it->value;
+    }
+
+    // Calls `callback` with every binding that isn't shadowed by one in a layer above it.
+    template<typename Callback>
+    void for_each(Callback callback) const
+    {
+        for (auto* layer = this; layer; layer = layer->base.ptr()) {
+            for (auto& entry : layer->bindings) {
+                auto shadowed = false;
+                for (auto* above = this; above != layer && !shadowed; above = above->base.ptr())
+                    shadowed = above->bindings.contains(entry.key);
+                if (!shadowed)
+                    callback(entry.key, entry.value);
+            }
+        }
+    }
+
+    // Binds `key` in this layer, charging the heap for whatever storage it grows by.
+    template<typename K, typename V>
+    void set(K const& key, V value)
+    {
+        size_t old_size = 0;
+        if (auto it = bindings.find(key); it != bindings.end()) {
+            old_size = storage_size(it->value);
+        } else {
+            this->account(sizeof(*bindings.begin()));
+            if (!base || !base->find(key))
+                ++size;
+        }
+        auto new_size = storage_size(value);
+        bindings.set(key, move(value));
+        if (new_size > old_size)
+            this->account(new_size - old_size);
+    }
+
+    virtual void visit_edges(HeapCell::Visitor& visitor) const override
+    {
+        for (auto& entry : bindings)
+            visit_value_edges(entry.value, visitor);
+        if (base)
+            visitor.visit(*base);
+    }
+
+    virtual void clear_edges() override
+    {
+        bindings.clear();
+        base = nullptr;
+    }
+
+    // Bindings made in this layer, shadowing those in `base`.
+    T bindings;
+    RefPtr<SharedFrame> base;
+    // The number of bindings across every layer, shadowed ones not counted.
+    size_t size { 0 };
+};
+
+// A scope frame that is shared between contexts and closures, and never changed once it is.
+template<typename T>
+class Frame {
+public:
+    Frame()
+        : m_frame(make_ref_counted<SharedFrame<T>>())
+    {
+    }
+
+    template<typename K>
+    auto find(K const& key) const { return m_frame->find(key); }
+
+    template<typename K>
+    auto get(K const& key) const
+    {
+        using Bound = RemoveCVReference<decltype(*find(key))>;
+        auto value = find(key);
+        return value ? Optional<Bound>(*value) : Optional<Bound> {};
+    }
+
+    size_t size() const { return m_frame->size; }
+
+    template<typename Callback>
+    void for_each(Callback callback) const { m_frame->for_each(move(callback)); }
+
+    SharedFrame<T>& shared() const { return const_cast<SharedFrame<T>&>(*m_frame); }
+
+    template<typename K, typename V>
+    void set(K const& key, V value)
+    {
+        if (m_frame->ref_count() > 1)
+            m_frame = make_ref_counted<SharedFrame<T>>(m_frame);
+        m_frame->set(key, move(value));
+        while (m_frame->base && m_frame->bindings.size() >= m_frame->base->bindings.size())
+            m_frame = SharedFrame<T>::merged(*m_frame);
+    }
+
+private:
+    NonnullRefPtr<SharedFrame<T>> m_frame;
+};
+
+using Scope = HashMap<String, Value>;
+using CommentScope = HashMap<Comment*, Vector<Value>>;
+
 struct FunctionValue {
     NonnullRefPtr<FunctionNode> node;
-    Vector<HashMap<String, Value>> scope;
-    Vector<HashMap<Comment*, Vector<Value>>> comment_scope;
+    Vector<Frame<Scope>> scope;
+    Vector<Frame<CommentScope>> comment_scope;
 };
 
 struct Value {
@@ -178,18 +355,174 @@ struct Value {
 
     Value& operator=(Value const&) = default;
 
-    Variant<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NonnullRefPtr<CommentResolutionSet>, NativeFunctionType, RecordValue> value;
+    Variant<Empty, NumberType, String, NonnullRefPtr<Type>, FunctionValue, NonnullRefPtr<CommentResolutionSet>, NativeFunctionType, RecordValue, MappedString, NonnullRefPtr<Sequence>> value;
 };
 
-struct CommentResolutionSet : public AK::RefCounted<CommentResolutionSet> {
+inline size_t storage_size(Value const&) { return 0; }
+inline size_t storage_size(Vector<Value> const& values) { return values.size() * sizeof(Value); }
+
+// A set may also be a call or member access deferred over another set, whose values are then computed in order as they
+// are asked for. Consumers that need every value materialize the set first.
+struct CommentResolutionSet : public RefCountedCell<CommentResolutionSet, AllocationKind::ResolutionSet> {
+    // Calls and member accesses on sets at least this large are deferred.
+    static constexpr size_t defer_threshold = 16;
+
+    struct DeferredMap {
+        ~DeferredMap();
+
+        NonnullRefPtr<CommentResolutionSet> source;
+        // The Call or MemberAccess applied to each of `source`'s values, with the arguments of that call.
+        NonnullRefPtr<ASTNode> node;
+        Vector<Value> arguments;
+    };
+
+    virtual void visit_edges(HeapCell::Visitor&) const override;
+    virtual void clear_edges() override;
+
+    size_t size() const { return deferred ? deferred->source->size() : values.size(); }
+    Value at(Context&, size_t index) const;
+    Vector<Value>& materialize(Context&) const;
+
+    // For a deferred set, only the values computed so far.
+    mutable Vector<Value> values;
+    mutable OwnPtr<DeferredMap> deferred;
+};
+
+// A series of values computed only as they're iterated over: a source, and stages applied to each of its values in turn.
+// Adding a stage makes a new sequence with the same source, so chained stages never build intermediate sequences.
+struct Sequence : public RefCountedCell<Sequence, AllocationKind::Sequence> {
+    // `start`, `start + step`, ... up to but not including `end`.
+    struct Range {
+        i64 start { 0 };
+        i64 end { 0 };
+        i64 step { 1 };
+    };
+
+    // `seed`, and then `step` of the previous value, up to the first empty one.
+    struct Generator {
+        Value seed;
+        Value step;
+    };
+
+    enum class StageKind : u8 {
+        Map,
+        Filter,
+        Take,
+    };
+
+    struct Stage {
+        StageKind kind;
+        // The function mapped or filtered by, empty for Take.
+        Value function;
+        // The number of values Take lets through.
+        size_t count { 0 };
+    };
+
+    // Sources given as values are strings (their characters), records (their members, or elements for lists), and sets.
+    Sequence(Variant<Range, Generator, Value> source, Vector<Stage> stages)
+        : source(move(source))
+        , stages(move(stages))
+    {
+        account(this->stages.size() * sizeof(Stage));
+    }
+
+    virtual void visit_edges(HeapCell::Visitor&) const override;
+    virtual void clear_edges() override;
+
+    Variant<Range, Generator, Value> source;
+    Vector<Stage> stages;
+};
+
+// Records share their members until they're changed, like scope frames.
+struct RecordMembers : public RefCountedCell<RecordMembers, AllocationKind::Record> {
+    explicit RecordMembers(Vector<Value> values)
+        : values(move(values))
+    {
+        account(this->values.size() * sizeof(Value));
+    }
+
+    virtual void visit_edges(HeapCell::Visitor&) const override;
+    virtual void clear_edges() override;
+
     Vector<Value> values;
 };
 
+inline RecordValue RecordValue::create(NonnullRefPtr<Type> type, Vector<Value> members)
+{
+    return { move(type), make_ref_counted<RecordMembers>(move(members)) };
+}
+
+class ContextSnapshot;
+class EventLoop;
+
+// A call of a user function in progress, with what the caller had in scope until then.
+struct CallFrame {
+    FunctionNode const* function { nullptr };
+    Vector<Frame<Scope>> caller_scope;
+    Vector<Frame<CommentScope>> caller_comment_scope;
+    Vector<Comment*> caller_unassigned_comments;
+    size_t caller_scope_start { 0 };
+    // Whether the function's tail calls may be left to this frame to make, as Call does but InlineCall doesn't.
+    bool takes_tail_calls { false };
+};
+
+// A call the innermost frame has been left to make once its function's body is done.
+struct TailCall {
+    FunctionValue function;
+    Vector<Value> arguments;
+};
+
 struct Context {
-    Vector<HashMap<String, Value>> scope;
-    Vector<HashMap<Comment*, Vector<Value>>> comment_scope;
+    // Each call still nests a few nodes' worth of native frames, so this is kept well within what a thread's stack holds.
+    static constexpr size_t default_max_call_depth = 1'000;
+    // Native stack left for natives and reporting errors once script execution is stopped.
+    static constexpr size_t native_stack_reserve = 256 * KiB;
+
+    Vector<Frame<Scope>> scope;
+    Vector<Frame<CommentScope>> comment_scope;
     Vector<Comment*> unassigned_comments;
     size_t last_call_scope_start { 0 };
+
+    // The snapshot this context was forked from, if any; keeps the comments it refers to alive.
+    RefPtr<ContextSnapshot> base;
+
+    // Cells created while this context's heap is active are collected with it.
+    NonnullOwnPtr<Heap> heap { make<Heap>() };
+
+    // What the script prints; flushed when the context is destroyed.
+    NonnullOwnPtr<OutputBuffer> output { make<OutputBuffer>() };
+
+    // Set once execution has to be abandoned; every node run after this evaluates to nothing.
+    Optional<String> error;
+
+    // The calls of user functions in progress, innermost last. Calling deeper than `max_call_depth` is a stack overflow.
+    Vector<CallFrame> call_stack;
+    size_t max_call_depth { default_max_call_depth };
+    Optional<TailCall> tail_call;
+
+    // Running nodes with the native stack below this address is a stack overflow too, so that scripts recursing deeper
+    // than the thread running them has stack for are stopped instead of crashing; found when the context first runs.
+    FlatPtr native_stack_limit { 0 };
+
+    OwnPtr<Profiler> profiler;
+    OwnPtr<Tracer> tracer;
+
+    // Where timers and file reads the script starts are waited on, if it's allowed to start any.
+    EventLoop* event_loop { nullptr };
+
+    RuntimeStatistics statistics;
+
+    // Whether hot functions the optimizer found compilable are run as native code.
+    bool jit_enabled { true };
+
+    // Whether loop and sequence natives call small closures in place, reusing the scope set up for them.
+    bool inlining_enabled { true };
+
+    String const& track(String const& string)
+    {
+        heap->track(string);
+        return string;
+    }
 };
 
 Value& flatten(Value& input);